@@ -0,0 +1,81 @@
+#!/usr/bin/env python3
+
+import socket
+import sys
+import threading
+import time
+
+
+def connect(address):
+    if address.startswith("localhost:"):
+        address = address[len("localhost:"):]
+    if address.isdigit():
+        return socket.create_connection(("127.0.0.1", int(address)))
+    s = socket.socket(socket.AF_UNIX)
+    s.connect(address)
+    return s
+
+
+def client(address, lines, pipeline, commands, results, latencies):
+    s = connect(address)
+    f = s.makefile("rb")
+
+    for command in commands:
+        s.sendall((command + "\n").encode())
+        reply = f.readline().decode().rstrip("\n")
+        if reply != "!ok":
+            print("Command {} failed: {}".format(command, reply))
+            exit(1)
+
+    # Sends up to pipeline lines before reading the replies, so the server can batch them
+    for i in range(0, len(lines), pipeline):
+        chunk = lines[i:i + pipeline]
+        start = time.time()
+        s.sendall("".join(line + "\n" for _, line in chunk).encode())
+        for j, _ in chunk:
+            results[j] = f.readline().decode()
+        latencies.append((time.time() - start) / len(chunk))
+    s.close()
+
+
+if __name__ == "__main__":
+    if len(sys.argv) < 4:
+        print("Usage: serve_load.py <address> <data file> <clients> [pipeline] [output file] [command ...]")
+        print("Sends lines of the data file to nxc serve from concurrent clients and prints throughput and latency,")
+        print("commands (e.g. \"!topK 5\") are sent by every client before the data")
+        exit(1)
+
+    address = sys.argv[1]
+    clients = int(sys.argv[3])
+    pipeline = int(sys.argv[4]) if len(sys.argv) > 4 else 1
+    output = sys.argv[5] if len(sys.argv) > 5 else None
+    commands = sys.argv[6:]
+
+    with open(sys.argv[2]) as file:
+        lines = [line.rstrip("\n") for line in file]
+    # Skip LibSvm header
+    if lines and len(lines[0].split(" ")) == 3 and all(t.isdigit() for t in lines[0].split(" ")):
+        lines = lines[1:]
+    lines = [(i, line) for i, line in enumerate(l for l in lines if l)]
+
+    results = [None] * len(lines)
+    latencies = []
+    threads = [threading.Thread(target=client, args=(address, lines[c::clients], pipeline, commands, results, latencies))
+               for c in range(clients)]
+
+    start = time.time()
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    elapsed = time.time() - start
+
+    latencies.sort()
+    print("Requests: {}, clients: {}, pipeline: {}".format(len(lines), clients, pipeline))
+    print("Time: {:.3f}s, requests/s: {:.0f}".format(elapsed, len(lines) / elapsed))
+    print("Latency per request: p50: {:.3f}ms, p99: {:.3f}ms".format(latencies[len(latencies) // 2] * 1e3,
+                                                                     latencies[int(len(latencies) * 0.99)] * 1e3))
+
+    if output is not None:
+        with open(output, "w") as file:
+            file.write("".join(results))
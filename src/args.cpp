@@ -8,6 +8,7 @@
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <stdexcept>
 
 #include "args.h"
 #include "resources.h"
@@ -38,6 +39,7 @@ Args::Args() {
     eps = 0.1;
     cost = 16.0;
     maxIter = 100;
+    labelsBlock = 1;
     autoCLin = false;
     autoCLog = false;
 
@@ -73,6 +75,9 @@ Args::Args() {
     kMeansEps = 0.0001;
     kMeansBalanced = true;
     kMeansWeightedFeatures = false;
+    kMeansMiniBatch = 0;
+    kMeansMiniBatchDepth = 1;
+    kMeansProjection = 0;
 
     // Online PLT options
     onlineTreeAlpha = 0.5;
@@ -80,8 +85,11 @@ Args::Args() {
     // Prediction options
     topK = 5;
     threshold = 0.0;
+    beam = 0;
     thresholds = "";
     ensMissingScores = true;
+    invertedIndex = false;
+    packWeights = false;
 
     // Mips options
     mipsDense = false;
@@ -101,6 +109,7 @@ Args::Args() {
 
     // Measures for test command
     measures = "p@1,r@1,c@1,p@3,r@3,c@3,p@5,r@5,c@5";
+    metricsFile = "";
 
     // Args for OFO command
     ofoType = micro;
@@ -112,6 +121,27 @@ Args::Args() {
     // Args for testPredictionTime command
     batchSizes = "100,1000,10000";
     batches = 10;
+
+    // Args for serve command
+    maxBatchSize = 64;
+    batchTimeout = 100;
+    maxQueueSize = 4096;
+    reloadInterval = 5;
+}
+
+PredictOptions::PredictOptions(const Args& args) {
+    topK = args.topK;
+    threshold = args.threshold;
+    beam = args.beam;
+    ensMissingScores = args.ensMissingScores;
+    threads = args.threads;
+
+    setUtilityType = args.setUtilityType;
+    alpha = args.alpha;
+    beta = args.beta;
+    delta = args.delta;
+    gamma = args.gamma;
+    ubopMipsK = args.ubopMipsK;
 }
 
 // Parse args
@@ -123,15 +153,14 @@ void Args::parseArgs(const std::vector<std::string>& args) {
 
     }
 
-    if (command != "train" && command != "test" && command != "predict" && command != "ofo" && command != "testPredictionTime") {
-        std::cerr << "Unknown command type: " << command << "!\n";
-        printHelp();
+    if (command != "train" && command != "test" && command != "predict" && command != "ofo" && command != "testPredictionTime"
+        && command != "serve" && command != "buildIndex") {
+        throw std::invalid_argument("Unknown command type: " + command + "!");
     }
 
     for (int ai = 2; ai < args.size(); ai += 2) {
         if (args[ai][0] != '-') {
-            std::cerr << "Provided argument without a dash: " << args[ai] << "!\n";
-            printHelp();
+            throw std::invalid_argument("Provided argument without a dash: " + args[ai] + "!");
         }
 
         try {
@@ -152,8 +181,7 @@ void Args::parseArgs(const std::vector<std::string>& args) {
                 else if (args.at(ai + 1) == "vw" || args.at(ai + 1) == "vowpalwabbit")
                     dataFormatType = vw;
                 else {
-                    std::cerr << "Unknown date format type: " << args.at(ai + 1) << "!\n";
-                    printHelp();
+                    throw std::invalid_argument("Unknown date format type: " + args.at(ai + 1) + "!");
                 }
             } else if (args[ai] == "--ensemble")
                 ensemble = std::stoi(args.at(ai + 1));
@@ -185,13 +213,11 @@ void Args::parseArgs(const std::vector<std::string>& args) {
                     modelType = ubopMips;
 #else
                     else if (args.at(ai + 1) == "brMips" || args.at(ai + 1) == "ubopMips") {
-                        std::cerr << args.at(ai + 1) << " model requires MIPS extension";
-                        exit(EXIT_FAILURE);
+                        throw std::invalid_argument(args.at(ai + 1) + " model requires MIPS extension");
                     }
 #endif
                 else {
-                    std::cerr << "Unknown model type: " << args.at(ai + 1) << "!\n";
-                    printHelp();
+                    throw std::invalid_argument("Unknown model type: " + args.at(ai + 1) + "!");
                 }
             } else if (args[ai] == "--mipsDense")
                 mipsDense = std::stoi(args.at(ai + 1)) != 0;
@@ -224,8 +250,7 @@ void Args::parseArgs(const std::vector<std::string>& args) {
                 else if (args.at(ai + 1) == "uAlphaBeta")
                     setUtilityType = uAlphaBeta;
                 else {
-                    std::cerr << "Unknown set utility type: " << args.at(ai + 1) << "!\n";
-                    printHelp();
+                    throw std::invalid_argument("Unknown set utility type: " + args.at(ai + 1) + "!");
                 }
             } else if (args[ai] == "--alpha")
                 alpha = std::stof(args.at(ai + 1));
@@ -265,6 +290,8 @@ void Args::parseArgs(const std::vector<std::string>& args) {
                 cost = std::stof(args.at(ai + 1));
             else if (args[ai] == "--maxIter")
                 maxIter = std::stoi(args.at(ai + 1));
+            else if (args[ai] == "--labelsBlock")
+                labelsBlock = std::stoi(args.at(ai + 1));
             else if (args[ai] == "--inbalanceLabelsWeighting")
                 inbalanceLabelsWeighting = std::stoi(args.at(ai + 1)) != 0;
             else if (args[ai] == "--pickOneLabelWeighting")
@@ -286,8 +313,7 @@ void Args::parseArgs(const std::vector<std::string>& args) {
                 else if (args.at(ai + 1) == "L1R_L2LOSS_SVC")
                     solverType = L1R_L2LOSS_SVC;
                 else {
-                    std::cerr << "Unknown solver type: " << args.at(ai + 1) << "!\n";
-                    printHelp();
+                    throw std::invalid_argument("Unknown solver type: " + args.at(ai + 1) + "!");
                 }
             } else if (args[ai] == "--optimizer") {
                 optimizerName = args.at(ai + 1);
@@ -300,8 +326,7 @@ void Args::parseArgs(const std::vector<std::string>& args) {
                 else if (args.at(ai + 1) == "fobos")
                     optimizerType = fobos;
                 else {
-                    std::cerr << "Unknown optimizer type: " << args.at(ai + 1) << "!\n";
-                    printHelp();
+                    throw std::invalid_argument("Unknown optimizer type: " + args.at(ai + 1) + "!");
                 }
             } else if (args[ai] == "-l" || args[ai] == "--lr" || args[ai] == "--eta")
                 eta = std::stof(args.at(ai + 1));
@@ -329,6 +354,12 @@ void Args::parseArgs(const std::vector<std::string>& args) {
                 kMeansBalanced = std::stoi(args.at(ai + 1)) != 0;
             else if (args[ai] == "--kMeansWeightedFeatures")
                 kMeansWeightedFeatures = std::stoi(args.at(ai + 1)) != 0;
+            else if (args[ai] == "--kMeansMiniBatch")
+                kMeansMiniBatch = std::stoi(args.at(ai + 1));
+            else if (args[ai] == "--kMeansMiniBatchDepth")
+                kMeansMiniBatchDepth = std::stoi(args.at(ai + 1));
+            else if (args[ai] == "--kMeansProjection")
+                kMeansProjection = std::stoi(args.at(ai + 1));
             else if (args[ai] == "--treeStructure") {
                 treeStructure = std::string(args.at(ai + 1));
                 treeType = custom;
@@ -356,8 +387,7 @@ void Args::parseArgs(const std::vector<std::string>& args) {
                     treeType = onlineBestScore;
 
                 else {
-                    std::cerr << "Unknown tree type: " << args.at(ai + 1) << "!\n";
-                    printHelp();
+                    throw std::invalid_argument("Unknown tree type: " + args.at(ai + 1) + "!");
                 }
             } else if (args[ai] == "--onlineTreeAlpha")
                 onlineTreeAlpha = std::stof(args.at(ai + 1));
@@ -372,8 +402,7 @@ void Args::parseArgs(const std::vector<std::string>& args) {
                 else if (args.at(ai + 1) == "mixed")
                     ofoType = mixed;
                 else {
-                    std::cerr << "Unknown ofo type: " << args.at(ai + 1) << "!\n";
-                    printHelp();
+                    throw std::invalid_argument("Unknown ofo type: " + args.at(ai + 1) + "!");
                 }
             } else if (args[ai] == "--ofoTopLabels")
                 ofoTopLabels = std::stoi(args.at(ai + 1));
@@ -389,35 +418,47 @@ void Args::parseArgs(const std::vector<std::string>& args) {
                 threshold = std::stof(args.at(ai + 1));
             else if (args[ai] == "--thresholds")
                 thresholds = std::string(args.at(ai + 1));
+            else if (args[ai] == "--beam")
+                beam = std::stoi(args.at(ai + 1));
             else if (args[ai] == "--ensMissingScores")
                 ensMissingScores = std::stoi(args.at(ai + 1)) != 0;
+            else if (args[ai] == "--invertedIndex")
+                invertedIndex = std::stoi(args.at(ai + 1)) != 0;
+            else if (args[ai] == "--packWeights")
+                packWeights = std::stoi(args.at(ai + 1)) != 0;
 
             else if (args[ai] == "--batchSizes")
                 batchSizes = args.at(ai + 1);
             else if (args[ai] == "--batches")
                 batches = std::stoi(args.at(ai + 1));
 
+            else if (args[ai] == "--maxBatchSize")
+                maxBatchSize = std::stoi(args.at(ai + 1));
+            else if (args[ai] == "--batchTimeout")
+                batchTimeout = std::stoi(args.at(ai + 1));
+            else if (args[ai] == "--maxQueueSize")
+                maxQueueSize = std::stoi(args.at(ai + 1));
+            else if (args[ai] == "--reloadInterval")
+                reloadInterval = std::stoi(args.at(ai + 1));
+
             else if (args[ai] == "--measures")
                 measures = std::string(args.at(ai + 1));
+            else if (args[ai] == "--metricsFile")
+                metricsFile = std::string(args.at(ai + 1));
             else if (args[ai] == "--autoCLin")
                 autoCLin = std::stoi(args.at(ai + 1)) != 0;
             else if (args[ai] == "--autoCLog")
                 autoCLog = std::stoi(args.at(ai + 1)) != 0;
-            else {
-                std::cerr << "Unknown argument: " << args[ai] << std::endl;
-                printHelp();
-            }
+            else
+                throw std::invalid_argument("Unknown argument: " + args[ai] + "!");
 
         } catch (std::out_of_range) {
-            std::cerr << args[ai] << " is missing an argument!\n";
-            printHelp();
+            throw std::invalid_argument(args[ai] + " is missing an argument!");
         }
     }
 
-    if (input.empty() || output.empty()) {
-        std::cerr << "Empty input or model path!\n";
-        printHelp();
-    }
+    if (output.empty()) throw std::invalid_argument("Empty model path!");
+    if (input.empty() && command != "buildIndex") throw std::invalid_argument("Empty input path!");
 
     // Change default values for specific cases + parameters warnings
     if (modelType == oplt && optimizerType == liblinear) {
@@ -456,9 +497,10 @@ void Args::printArgs() {
 
     if (command == "train") {
         std::cerr << "\n  Base models optimizer: " << optimizerName;
-        if (optimizerType == liblinear)
+        if (optimizerType == liblinear) {
             std::cerr << "\n    Solver: " << solverName << ", eps: " << eps << ", cost: " << cost << ", max iter: " << maxIter;
-        else
+            if (labelsBlock > 1) std::cerr << ", labels block: " << labelsBlock;
+        } else
             std::cerr << "\n    Eta: " << eta << ", epochs: " << epochs;
         if (optimizerType == adagrad) std::cerr << ", AdaGrad eps " << adagradEps;
         if (optimizerType == fobos) std::cerr << ", Fobos penalty: " << fobosPenalty;
@@ -470,6 +512,10 @@ void Args::printArgs() {
                 if (treeType == hierarchicalKMeans)
                     std::cerr << ", k-means eps: " << kMeansEps << ", balanced: " << kMeansBalanced
                               << ", weighted features: " << kMeansWeightedFeatures;
+                if (treeType == hierarchicalKMeans && kMeansMiniBatch > 0)
+                    std::cerr << ", mini-batch: " << kMeansMiniBatch << ", mini-batch depth: " << kMeansMiniBatchDepth;
+                if (treeType == hierarchicalKMeans && kMeansProjection > 0)
+                    std::cerr << ", projection: " << kMeansProjection;
                 if (treeType == hierarchicalKMeans || treeType == balancedInOrder || treeType == balancedRandom)
                     std::cerr << ", max leaves: " << maxLeaves;
             } else {
@@ -478,9 +524,13 @@ void Args::printArgs() {
         }
     }
 
-    if (command == "test") {
+    if ((command == "train" || command == "buildIndex") && (modelType == ubopMips || modelType == brMips))
+        std::cerr << "\n  HNSW: M: " << hnswM << ", efConst.: " << hnswEfConstruction;
+
+    if (command == "test" || command == "serve") {
         if(thresholds.empty()) std::cerr << "\n  Top k: " << topK << ", threshold: " << threshold;
         else std::cerr << "\n  Thresholds: " << thresholds;
+        if (beam > 0) std::cerr << ", beam: " << beam;
         if (modelType == ubopMips || modelType == brMips) {
             std::cerr << "\n  HNSW: M: " << hnswM << ", efConst.: " << hnswEfConstruction << ", efSearch: " << hnswEfSearch;
             if(modelType == ubopMips) std::cerr << ", k: " << ubopMipsK;
@@ -496,6 +546,10 @@ void Args::printArgs() {
     if (command == "ofo")
         std::cerr << "\n  Epochs: " << epochs << ", a: " << ofoA << ", b: " << ofoB;
 
+    if (command == "serve")
+        std::cerr << "\n  Max batch size: " << maxBatchSize << ", batch timeout: " << batchTimeout
+                  << ", max queue size: " << maxQueueSize << ", reload interval: " << reloadInterval;
+
     std::cerr << "\n  Threads: " << threads << ", memory limit: " << formatMem(memLimit)
               << "\n  Seed: " << seed << std::endl;
 }
@@ -509,6 +563,8 @@ Commands:
     predict
     ofo
     testPredictionTime
+    serve
+    buildIndex
 
 Args:
     General:
@@ -547,6 +603,8 @@ Args:
                         Note: -1 to automatically find best value for each node.
     -e, --eps           Stopping criteria (default = 0.1)
                         See: https://github.com/cjlin1/liblinear
+    --labelsBlock       Number of labels trained together by BR and OVR models (default = 1)
+                        Note: supported only by L2R_LR_DUAL solver
 
     SGD/AdaGrad/Fobos:
     -l, --lr, --eta     Step size (learning rate) of SGD/AdaGrad/Fobos (default = 1.0)
@@ -567,10 +625,24 @@ Args:
     K-means tree:
     --kMeansEps         Stopping criteria for K-Means clustering (default = 0.001)
     --kMeansBalanced    Use balanced K-Means clustering (default = 1)
+    --kMeansMiniBatch   Size of the batch for mini-batch K-Means clustering of large partitions,
+                        0 means exact K-Means everywhere (default = 0)
+    --kMeansMiniBatchDepth
+                        Use mini-batch K-Means for the nodes up to given depth, root has depth 1 (default = 1)
+    --kMeansProjection  Project labels' features to given number of dense dimensions using sparse random
+                        projection before K-Means clustering, 0 means no projection (default = 0)
 
     Prediction:
     --topK              Predict top k elements (default = 5)
     --threshold         Probability threshold (default = 0)
+    --beam              Use level-synchronous beam search of given width for PLT and HSM models
+                        instead of exact best-first search, 0 means exact search (default = 0)
+    --invertedIndex     Transpose weights of br and ovr models to feature postings when loading the model,
+                        so only labels with weights for the data point's features are scored. Faster for sparse
+                        data and pruned weights, but needs additional memory (default = 0)
+    --packWeights       Pack dense weights of br and ovr models in tiles of labels when loading the model,
+                        so blocks of data points are scored together in batch prediction. Faster for dense
+                        weights, but keeps the second copy of the weights in memory (default = 0)
     --setUtility        Type of set-utility function for prediction using ubop, ubopHsm, ubopMips models.
                         Set-utility functions: uP, uF1, uAlpha, uAlphaBeta, uDeltaGamma
                         See: https://arxiv.org/abs/1906.08129
@@ -585,6 +657,29 @@ Args:
     --measures          Evaluate test using set of measures (default = "p@1,r@1,c@1,p@3,r@3,c@3,p@5,r@5,c@5")
                         Measures: acc (accuracy), p (precision), r (recall), c (coverage),
                                   p@k (precision at k), r@k (recall at k), c@k (coverage at k), s (prediction size)
+    --metricsFile       Save prediction metrics (latency, evaluated estimators and queue sizes) to the file in JSON format
+
+    MIPS:
+    --mipsDense         Use dense vectors in the HNSW index of brMips and ubopMips models (default = 0)
+    --hnswM             Maximum number of neighbours of a node in the HNSW graph (default = 20)
+    --hnswEfConstruction
+                        Size of the candidates list during building of the HNSW graph (default = 100)
+    --hnswEfSearch      Size of the candidates list during prediction (default = 100)
+                        Note: the HNSW graph is built and saved in the model directory after training,
+                        buildIndex command builds it again for the model, e.g. with different M and efConstruction
+
+    Serve:
+    -i, --input         Address to listen on, path of Unix domain socket or localhost TCP port (e.g. 8080, localhost:8080)
+    --maxBatchSize      Maximum number of requests predicted together by one worker (default = 64)
+    --batchTimeout      Time in microseconds a worker waits for more requests to fill the batch (default = 100)
+    --maxQueueSize      Maximum number of queued requests, clients are not read when the queue is full (default = 4096)
+    --reloadInterval    Interval in seconds of checking if a new model directory appeared at the model path
+                        and reloading the model, 0 to disable (default = 5)
+                        Note: a new model should be deployed by renaming a directory or switching a symlink
+                        Protocol: every line sent by a client is a data point in the model's data format,
+                        the server replies with a line of predictions for each of them, lines "!topK <k>"
+                        and "!threshold <t>" change prediction settings of the next lines of the connection,
+                        "!reload" reloads the model, commands are replied with "!ok" or "!error <message>"
 
     )HELP";
     exit(EXIT_FAILURE);
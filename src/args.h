@@ -91,6 +91,7 @@ public:
     double eps;
     double cost;
     int maxIter;
+    int labelsBlock;
     double weightsThreshold;
     int ensemble;
     bool onTheTrotPrediction;
@@ -122,6 +123,9 @@ public:
     double kMeansEps;
     bool kMeansBalanced;
     bool kMeansWeightedFeatures;
+    int kMeansMiniBatch;
+    int kMeansMiniBatchDepth;
+    int kMeansProjection;
 
     // Online tree options
     double onlineTreeAlpha;
@@ -129,10 +133,17 @@ public:
     // Prediction options
     int topK;
     double threshold;
+    int beam;
     std::string thresholds;
     bool ensMissingScores;
+    bool invertedIndex;
+    bool packWeights;
 
     inline int getSeed() { return rngSeeder(); };
+    inline void setSeed(int newSeed) {
+        seed = newSeed;
+        rngSeeder.seed(seed);
+    };
     void parseArgs(const std::vector<std::string>& args);
     void printArgs();
     void printHelp();
@@ -158,6 +169,7 @@ public:
 
     // Measures for test command
     std::string measures;
+    std::string metricsFile;
 
     // Args for OFO command
     OFOType ofoType;
@@ -170,6 +182,12 @@ public:
     std::string batchSizes;
     int batches;
 
+    // Args for serve command
+    int maxBatchSize;
+    int batchTimeout;
+    int maxQueueSize;
+    int reloadInterval;
+
 private:
     std::default_random_engine rngSeeder;
 
@@ -180,3 +198,23 @@ private:
     std::string dataFormatName;
     std::string setUtilityName;
 };
+
+// Options of a single prediction call. Loaded models are read-only during prediction and take all the prediction
+// settings from these options, so many threads can predict with one model and different options at the same time.
+struct PredictOptions {
+    explicit PredictOptions(const Args& args);
+
+    int topK;
+    double threshold;
+    int beam;
+    bool ensMissingScores;
+    int threads; // Threads that the model can use for a single call
+
+    // Set utility options
+    SetUtilityType setUtilityType;
+    double alpha;
+    double beta;
+    double delta;
+    double gamma;
+    double ubopMipsK;
+};
@@ -74,7 +74,8 @@ void Base::unsafeUpdate(double label, Feature* features, Args& args) {
 }
 
 void Base::trainLiblinear(int n, int r, std::vector<double>& binLabels, std::vector<Feature*>& binFeatures,
-                          std::vector<double>* instancesWeights, int positiveLabels, Args& args) {
+                          std::vector<double>* instancesWeights, std::vector<double>* instancesNorms,
+                          Feature** instancesColumns, int positiveLabels, Args& args) {
 
     int labelsCount = 0;
     int* labels = NULL;
@@ -98,11 +99,7 @@ void Base::trainLiblinear(int n, int r, std::vector<double>& binLabels, std::vec
         }
     }
 
-    double cost = args.cost;
-    if(args.autoCLog)
-        cost *= 1.0 + log(static_cast<double>(r) / binFeatures.size());
-    if (args.autoCLin)
-        cost *= static_cast<double>(r) / binFeatures.size();
+    double cost = getCost(r, binFeatures.size(), args);
 
     auto y = binLabels.data();
     auto x = binFeatures.data();
@@ -120,7 +117,9 @@ void Base::trainLiblinear(int n, int r, std::vector<double>& binLabels, std::vec
                  .y = y,
                  .x = x,
                  .bias = -1,
-                 .W = instancesWeights->data()};
+                 .W = instancesWeights->data(),
+                 .xTx = (instancesNorms != nullptr) ? instancesNorms->data() : NULL,
+                 .x_col = instancesColumns};
 
     parameter C = {.solver_type = args.solverType,
                    .eps = args.eps,
@@ -161,6 +160,98 @@ void Base::trainLiblinear(int n, int r, std::vector<double>& binLabels, std::vec
     if(deleteInstanceWeights) delete instancesWeights;
 }
 
+void Base::trainBlock(int n, int r, std::vector<Base*>& bases, std::vector<std::vector<double>*>& binLabels,
+                      std::vector<Feature*>& binFeatures, std::vector<double>* instancesWeights,
+                      std::vector<double>* instancesNorms, Feature** instancesColumns, Args& args) {
+
+    // Only L2R_LR_DUAL solver has a block variant
+    if (bases.size() < 2 || args.optimizerType != liblinear || args.solverType != L2R_LR_DUAL) {
+        for (int i = 0; i < bases.size(); ++i)
+            bases[i]->train(n, r, *binLabels[i], binFeatures, instancesWeights, instancesNorms, instancesColumns,
+                            args);
+        return;
+    }
+
+    // Bases with examples of both classes are trained together, the rest as usual
+    std::vector<Base*> blockBases;
+    std::vector<const double*> blockLabels;
+    std::vector<double> Cp;
+    std::vector<double> Cn;
+    double cost = getCost(r, binFeatures.size(), args);
+    for (int i = 0; i < bases.size(); ++i) {
+        auto& labels = *binLabels[i];
+        int positiveLabels = std::count(labels.begin(), labels.end(), 1.0);
+        int negativeLabels = static_cast<int>(labels.size()) - positiveLabels;
+        if (positiveLabels == 0 || negativeLabels == 0) {
+            bases[i]->train(n, r, labels, binFeatures, instancesWeights, instancesNorms, instancesColumns, args);
+            continue;
+        }
+
+        blockBases.push_back(bases[i]);
+        blockLabels.push_back(labels.data());
+        Cp.push_back(cost);
+        Cn.push_back(cost);
+
+        // Apply some weighting for very unbalanced data
+        if (args.inbalanceLabelsWeighting) {
+            if (negativeLabels > positiveLabels)
+                Cp.back() *= 1.0 + log(static_cast<double>(negativeLabels) / positiveLabels);
+            else
+                Cn.back() *= 1.0 + log(static_cast<double>(positiveLabels) / negativeLabels);
+        }
+    }
+    if (blockBases.empty()) return;
+
+    int l = static_cast<int>(binFeatures.size());
+    int size = blockBases.size();
+
+    bool deleteInstanceWeights = false;
+    if (instancesWeights == nullptr) {
+        instancesWeights = new std::vector<double>(l, 1.0);
+        deleteInstanceWeights = true;
+    }
+
+    problem P = {.l = l,
+                 .n = n,
+                 .y = NULL,
+                 .x = binFeatures.data(),
+                 .bias = -1,
+                 .W = instancesWeights->data(),
+                 .xTx = (instancesNorms != nullptr) ? instancesNorms->data() : NULL,
+                 .x_col = NULL};
+
+    double* w = new double[static_cast<size_t>(n) * size];
+    solve_l2r_lr_dual_block(&P, blockLabels.data(), size, w, args.eps, Cp.data(), Cn.data(), args.maxIter);
+
+    // Set bases' attributes, positive class is always the first one
+    for (int i = 0; i < size; ++i) {
+        Base* base = blockBases[i];
+        base->wSize = n + 1;
+        base->firstClass = 1;
+        base->classCount = 2;
+        base->hingeLoss = false;
+
+        base->W = new Weight[base->wSize];
+        base->W[0] = 0;
+        for (int j = 0; j < n; ++j) base->W[j + 1] = w[static_cast<size_t>(j) * size + i];
+
+        base->pruneWeights(args.weightsThreshold);
+        if (base->sparseSize() < base->denseSize()) base->toSparse();
+    }
+
+    delete[] w;
+    if (deleteInstanceWeights) delete instancesWeights;
+}
+
+double Base::getCost(int r, int l, Args& args) {
+    double cost = args.cost;
+    if (args.autoCLog)
+        cost *= 1.0 + log(static_cast<double>(r) / l);
+    if (args.autoCLin)
+        cost *= static_cast<double>(r) / l;
+    return cost;
+}
+
 void Base::trainOnline(int n, std::vector<double>& binLabels, std::vector<Feature*>& binFeatures, Args& args) {
     setupOnlineTraining(args, n);
 
@@ -174,7 +265,8 @@ void Base::trainOnline(int n, std::vector<double>& binLabels, std::vector<Featur
 }
 
 void Base::train(int n, int r, std::vector<double>& binLabels, std::vector<Feature*>& binFeatures,
-                 std::vector<double>* instancesWeights, Args& args) {
+                 std::vector<double>* instancesWeights, std::vector<double>* instancesNorms,
+                 Feature** instancesColumns, Args& args) {
 
     if(instancesWeights != nullptr && args.optimizerType != liblinear)
         throw std::invalid_argument("train: optimizer type does not support training with weights");
@@ -194,9 +286,11 @@ void Base::train(int n, int r, std::vector<double>& binLabels, std::vector<Featu
 
     //assert(binLabels.size() == binFeatures.size());
     if (instancesWeights != nullptr) assert(instancesWeights->size() == binLabels.size());
+    if (instancesNorms != nullptr) assert(instancesNorms->size() == binLabels.size());
 
     if (args.optimizerType == liblinear)
-        trainLiblinear(n, r, binLabels, binFeatures, instancesWeights, positiveLabels, args);
+        trainLiblinear(n, r, binLabels, binFeatures, instancesWeights, instancesNorms, instancesColumns,
+                       positiveLabels, args);
     else
         trainOnline(n, binLabels, binFeatures, args);
 
@@ -205,6 +299,12 @@ void Base::train(int n, int r, std::vector<double>& binLabels, std::vector<Featu
     if (sparseSize() < denseSize()) toSparse();
 }
 
+bool Base::requiresSquaredNorms(Args& args) {
+    return args.optimizerType == liblinear &&
+           (args.solverType == L2R_LR_DUAL || args.solverType == L2R_L2LOSS_SVC_DUAL ||
+            args.solverType == L2R_L1LOSS_SVC_DUAL);
+}
+
 void Base::setupOnlineTraining(Args& args, int n, bool startWithDenseW) {
     wSize = n;
     if (wSize != 0 && startWithDenseW) {
@@ -234,7 +334,7 @@ void Base::finalizeOnlineTraining(Args& args) {
     pruneWeights(args.weightsThreshold);
 }
 
-double Base::predictValue(Feature* features) {
+double Base::predictValue(Feature* features) const {
     if (classCount < 2) return static_cast<double>(firstClass * 10);
     double val = 0;
 
@@ -250,14 +350,24 @@ double Base::predictValue(Feature* features) {
     else
         throw std::runtime_error("Prediction using sparse features and sparse weights is not supported!");
 
+    return valueFromDot(val);
+}
+
+double Base::predictProbability(Feature* features) const {
+    return probabilityFromValue(predictValue(features));
+}
+
+double Base::valueFromDot(double dot) const {
+    if (classCount < 2) return static_cast<double>(firstClass * 10);
+    double val = dot;
     if (firstClass == 0) val *= -1;
     val /= pi; // Fobos
 
     return val;
 }
 
-double Base::predictProbability(Feature* features) {
-    double val = predictValue(features);
+double Base::probabilityFromValue(double value) const {
+    double val = value;
     if (hingeLoss)
         //val = 1.0 / (1.0 + std::exp(-2 * val)); // Probability for squared Hinge loss solver
         val = std::exp(-std::pow(std::max(0.0, 1.0 - val), 2)); // Parabel probability for squared Hinge loss solver
@@ -24,17 +24,30 @@ public:
     void update(double label, Feature* features, Args& args);
     void unsafeUpdate(double label, Feature* features, Args& args);
     void train(int n, int r, std::vector<double>& binLabels, std::vector<Feature*>& binFeatures,
-               std::vector<double>* instancesWeights, Args& args);
+               std::vector<double>* instancesWeights, std::vector<double>* instancesNorms,
+               Feature** instancesColumns, Args& args);
     void trainLiblinear(int n, int r, std::vector<double>& binLabels, std::vector<Feature*>& binFeatures,
-                        std::vector<double>* instancesWeights, int positiveLabel, Args& args);
+                        std::vector<double>* instancesWeights, std::vector<double>* instancesNorms,
+                        Feature** instancesColumns, int positiveLabel, Args& args);
     void trainOnline(int n, std::vector<double>& binLabels, std::vector<Feature*>& binFeatures, Args& args);
 
+    // Trains together bases of several labels that share the same features
+    static void trainBlock(int n, int r, std::vector<Base*>& bases, std::vector<std::vector<double>*>& binLabels,
+                           std::vector<Feature*>& binFeatures, std::vector<double>* instancesWeights,
+                           std::vector<double>* instancesNorms, Feature** instancesColumns, Args& args);
+
+    // True if the solver uses squared norms of instances, so they are worth to precompute once for all bases
+    static bool requiresSquaredNorms(Args& args);
+
     // For online training
     void setupOnlineTraining(Args& args, int n = 0, bool startWithDenseW = false);
     void finalizeOnlineTraining(Args& args);
 
-    double predictValue(Feature* features);
-    double predictProbability(Feature* features);
+    double predictValue(Feature* features) const;
+    double predictProbability(Feature* features) const;
+    // Value and probability for the already computed dot product of the weights and the features
+    double valueFromDot(double dot) const;
+    double probabilityFromValue(double value) const;
 
     inline Weight* getW() { return W; }
     inline UnorderedMap<int, Weight>* getMapW() { return mapW; }
@@ -63,6 +76,9 @@ public:
 
     bool isDummy() { return (classCount < 2); }
 
+    void forEachW(const std::function<void(Weight&)>& f);
+    void forEachIW(const std::function<void(const int&, Weight&)>& f);
+
     // Used for debug
     void printWeights();
 
@@ -91,8 +107,7 @@ private:
 
     template <typename T> void updateFobos(T& W, Feature* features, double grad, double eta, double penalty);
 
-    void forEachW(const std::function<void(Weight&)>& f);
-    void forEachIW(const std::function<void(const int&, Weight&)>& f);
+    static double getCost(int r, int l, Args& args);
 };
 
 template <typename T> void Base::updateSGD(T& W, Feature* features, double grad, double eta) {
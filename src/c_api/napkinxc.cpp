@@ -0,0 +1,110 @@
+/**
+ * Copyright (c) 2020 by Marek Wydmuch
+ * All rights reserved.
+ */
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "args.h"
+#include "data_reader.h"
+#include "misc.h"
+#include "model.h"
+#include "napkinxc.h"
+#include "types.h"
+
+struct NxcModel {
+    Args args;
+    std::shared_ptr<Model> model;
+};
+
+static thread_local std::string lastError;
+
+const char* nxc_last_error(void) { return lastError.c_str(); }
+
+NxcModel* nxc_load(const char* model_dir, const char* options) {
+    try {
+        if (model_dir == nullptr) throw std::invalid_argument("Empty model path!");
+
+        std::vector<std::string> arg = {"nxc", "predict", "-i", "-", "-o", model_dir};
+        if (options != nullptr)
+            for (const auto& o : split(options, ' '))
+                if (!o.empty()) arg.push_back(o);
+
+        std::unique_ptr<NxcModel> model(new NxcModel());
+        model->args.parseArgs(arg);
+        model->args.loadFromFile(joinPath(model->args.output, "args.bin"));
+
+        // Features are given as libsvm indices, other formats map their features with the saved data reader
+        if (model->args.dataFormatType != libsvm)
+            throw std::invalid_argument("Only models trained on data in libsvm format are supported!");
+
+        model->model = Model::factory(model->args);
+        model->model->load(model->args, model->args.output);
+        if (!model->args.thresholds.empty()) model->model->setThresholds(loadThresholds(model->args.thresholds));
+
+        // Prediction is done in the calling threads, so the model should not start its own threads
+        model->args.threads = 1;
+
+        return model.release();
+    } catch (const std::exception& e) {
+        lastError = e.what();
+        return nullptr;
+    }
+}
+
+void nxc_free(NxcModel* model) { delete model; }
+
+int nxc_output_size(const NxcModel* model) { return model->model->outputSize(); }
+
+int nxc_predict(const NxcModel* model, int rows, const int64_t* offsets, const int32_t* indices,
+                const double* values, int top_k, double threshold, int max_predictions, int32_t* labels,
+                double* scores, int32_t* counts) {
+    // Buffers are reused by the following calls of the thread
+    static thread_local std::vector<Feature> features;
+    static thread_local std::vector<Prediction> prediction;
+
+    try {
+        if (model == nullptr || offsets == nullptr || indices == nullptr || labels == nullptr || scores == nullptr ||
+            counts == nullptr)
+            throw std::invalid_argument("Null argument!");
+        if (rows < 0 || top_k < 0 || max_predictions < 0) throw std::invalid_argument("Negative size argument!");
+
+        const Args& args = model->args;
+        PredictOptions options(args);
+        options.topK = top_k;
+        options.threshold = threshold;
+
+        for (int r = 0; r < rows; ++r) {
+            // Prepare features in the same way as the data reader does
+            features.clear();
+            if (args.bias) features.push_back({1, 0.0});
+            for (int64_t i = offsets[r]; i < offsets[r + 1]; ++i)
+                features.push_back({indices[i] + 2, values != nullptr ? values[i] : 1.0});
+            DataReader::prepareFeatures(features, args);
+            features.push_back({-1, 0.0}); // Termination feature
+
+            prediction.clear();
+            if (!args.thresholds.empty())
+                model->model->predictWithThresholds(prediction, features.data(), options);
+            else
+                model->model->predict(prediction, features.data(), options);
+
+            int size = std::min<int>(prediction.size(), max_predictions);
+            size_t rOffset = static_cast<size_t>(r) * max_predictions;
+            for (int i = 0; i < size; ++i) {
+                labels[rOffset + i] = prediction[i].label;
+                scores[rOffset + i] = prediction[i].value;
+            }
+            counts[r] = size;
+        }
+    } catch (const std::exception& e) {
+        lastError = e.what();
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,62 @@
+/**
+ * Copyright (c) 2020 by Marek Wydmuch
+ * All rights reserved.
+ */
+
+/**
+ * C API of napkinXC library for in-process prediction.
+ * Loaded model can be used for prediction by many threads at the same time.
+ * Only models trained on data in libsvm format are supported.
+ */
+
+#ifndef NAPKINXC_H
+#define NAPKINXC_H
+
+#include <stdint.h>
+
+// The library is built with hidden visibility, only functions of the C API are exported
+#if defined(__GNUC__)
+#define NXC_API __attribute__((visibility("default")))
+#else
+#define NXC_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct NxcModel NxcModel;
+
+/* Returns message of the last error that occurred in the calling thread */
+NXC_API const char* nxc_last_error(void);
+
+/*
+ * Loads model from the directory created by train command. Options are given in the same form as to
+ * the command line tool, e.g. "--ensemble 3 --beam 10 --thresholds th.txt", and can be NULL.
+ * Returns NULL on failure, also if the model was trained on data in other format than libsvm.
+ */
+NXC_API NxcModel* nxc_load(const char* model_dir, const char* options);
+
+NXC_API void nxc_free(NxcModel* model);
+
+/* Returns the number of labels the model predicts */
+NXC_API int nxc_output_size(const NxcModel* model);
+
+/*
+ * Predicts rows of the sparse matrix in CSR format in the calling thread. Features of the row r are
+ * indices[offsets[r]], ..., indices[offsets[r + 1] - 1] with the same numbering as in the data files,
+ * values can be NULL for binary features. The best labels with probability not lower than the threshold are
+ * predicted, top_k = 0 means all of them. If the model was loaded with thresholds, they are used instead.
+ * At most max_predictions predictions of the row r are saved to labels and scores starting from
+ * r * max_predictions, counts[r] is set to the number of saved predictions.
+ * Returns 0 on success and -1 on failure.
+ */
+NXC_API int nxc_predict(const NxcModel* model, int rows, const int64_t* offsets, const int32_t* indices,
+                        const double* values, int top_k, double threshold, int max_predictions, int32_t* labels,
+                        double* scores, int32_t* counts);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -62,39 +62,13 @@ void DataReader::readData(SRMatrix<Label>& labels, SRMatrix<Feature>& features,
     while (getline(in, line)) {
         if (hRows) printProgress(i++, hRows); // If the number of rows is know, print progress
 
-        lLabels.clear();
-        lFeatures.clear();
-
-        // Add bias feature (bias feature has index 1)
-        if (args.bias) lFeatures.push_back({1, 0.0});
-
         try {
-            readLine(line, lLabels, lFeatures);
+            readPoint(line, lLabels, lFeatures, args);
         } catch (const std::exception& e) {
             std::cerr << "  Failed to read line " << i << " from input!\n";
             exit(1);
         }
 
-        // Hash features
-        if (args.hash) {
-            UnorderedMap<int, double> lHashed;
-            for (auto& f : lFeatures) lHashed[hash(f.index) % args.hash] += f.value;
-
-            lFeatures.clear();
-            for (const auto& f : lHashed) lFeatures.push_back({f.first + 2, f.second});
-        }
-
-        // Norm row
-        if (args.norm) unitNorm(lFeatures);
-
-        if (args.bias) lFeatures[0].value = args.biasValue;
-
-        // Apply features threshold
-        if (args.featuresThreshold > 0) threshold(lFeatures, args.featuresThreshold);
-
-        // Check if it requires sorting
-        if (!std::is_sorted(lFeatures.begin(), lFeatures.end())) sort(lFeatures.begin(), lFeatures.end());
-
         labels.appendRow(lLabels);
         features.appendRow(lFeatures);
     }
@@ -126,6 +100,51 @@ void DataReader::readData(SRMatrix<Label>& labels, SRMatrix<Feature>& features,
               << ", labels: " << labels.cols() << "\n  Data size: " << formatMem(labels.mem() + features.mem()) << std::endl;
 }
 
+void DataReader::readPoint(std::string& line, std::vector<Label>& lLabels, std::vector<Feature>& lFeatures,
+                           Args& args) {
+    lLabels.clear();
+    lFeatures.clear();
+
+    // Add bias feature (bias feature has index 1)
+    if (args.bias) lFeatures.push_back({1, 0.0});
+
+    readLine(line, lLabels, lFeatures);
+    prepareFeatures(lFeatures, args);
+}
+
+void DataReader::readKnownPoint(std::string& line, std::vector<Label>& lLabels, std::vector<Feature>& lFeatures,
+                                const Args& args) const {
+    lLabels.clear();
+    lFeatures.clear();
+
+    if (args.bias) lFeatures.push_back({1, 0.0});
+
+    readKnownLine(line, lLabels, lFeatures);
+    prepareFeatures(lFeatures, args);
+}
+
+void DataReader::prepareFeatures(std::vector<Feature>& lFeatures, const Args& args) {
+    // Hash features
+    if (args.hash) {
+        UnorderedMap<int, double> lHashed;
+        for (auto& f : lFeatures) lHashed[hash(f.index) % args.hash] += f.value;
+
+        lFeatures.clear();
+        for (const auto& f : lHashed) lFeatures.push_back({f.first + 2, f.second});
+    }
+
+    // Norm row
+    if (args.norm) unitNorm(lFeatures);
+
+    if (args.bias) lFeatures[0].value = args.biasValue;
+
+    // Apply features threshold
+    if (args.featuresThreshold > 0) threshold(lFeatures, args.featuresThreshold);
+
+    // Check if it requires sorting
+    if (!std::is_sorted(lFeatures.begin(), lFeatures.end())) sort(lFeatures.begin(), lFeatures.end());
+}
+
 void DataReader::save(std::ostream& out) {}
 
 void DataReader::load(std::istream& in) {}
@@ -5,6 +5,7 @@
 
 #pragma once
 
+#include <memory>
 #include <string>
 
 #include "args.h"
@@ -19,8 +20,17 @@ public:
     virtual ~DataReader();
 
     void readData(SRMatrix<Label>& labels, SRMatrix<Feature>& features, Args& args);
+    // Reads single data point and prepares its features (bias, hashing, norm, threshold) as readData does
+    void readPoint(std::string& line, std::vector<Label>& lLabels, std::vector<Feature>& lFeatures, Args& args);
+    // Same as readPoint, but only uses labels and features already known to the reader and never changes it,
+    // so it can be called concurrently (e.g. at prediction time)
+    void readKnownPoint(std::string& line, std::vector<Label>& lLabels, std::vector<Feature>& lFeatures,
+                        const Args& args) const;
+    // Prepares features read from the line, if bias is used, the first feature should be the bias feature
+    static void prepareFeatures(std::vector<Feature>& lFeatures, const Args& args);
     virtual void readHeader(std::string& line, int& hLabels, int& hFeatures, int& hRows);
     virtual void readLine(std::string& line, std::vector<Label>& lLabels, std::vector<Feature>& lFeatures) = 0;
+    virtual void readKnownLine(std::string& line, std::vector<Label>& lLabels, std::vector<Feature>& lFeatures) const = 0;
 
     void save(std::ostream& out) override;
     void load(std::istream& in) override;
@@ -19,9 +19,15 @@ void LibSvmReader::readHeader(std::string& line, int& hLabels, int& hFeatures, i
     hLabels = std::stoi(hTokens[2]);
 }
 
+void LibSvmReader::readLine(std::string& line, std::vector<Label>& lLabels, std::vector<Feature>& lFeatures) {
+    readKnownLine(line, lLabels, lFeatures);
+}
+
 // Reads line in LibSvm format label,label,... feature(:value) feature(:value) ...
+// LibSvm format uses numeric ids, so all labels and features are known and the reader keeps no state
 // TODO: rewrite this using split?
-void LibSvmReader::readLine(std::string& line, std::vector<Label>& lLabels, std::vector<Feature>& lFeatures) {
+void LibSvmReader::readKnownLine(std::string& line, std::vector<Label>& lLabels,
+                                 std::vector<Feature>& lFeatures) const {
     // Trim leading spaces
     size_t nextPos, pos = line.find_first_not_of(' ');
 
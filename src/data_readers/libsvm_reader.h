@@ -16,4 +16,5 @@ public:
 
     void readHeader(std::string& line, int& hLabels, int& hFeatures, int& hRows) override;
     void readLine(std::string& line, std::vector<Label>& lLabels, std::vector<Feature>& lFeatures) override;
+    void readKnownLine(std::string& line, std::vector<Label>& lLabels, std::vector<Feature>& lFeatures) const override;
 };
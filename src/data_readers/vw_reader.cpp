@@ -41,7 +41,7 @@ void VowpalWabbitReader::readLine(std::string& line, std::vector<Label>& lLabels
         }
 
         int index = featuresMap.size() + 2; // Feature (LibLinear ignore feature 0 and feature 1 is reserved for bias)
-        auto ff = featuresMap.find(f);
+        auto ff = featuresMap.find(sIndex);
         if (ff != featuresMap.end())
             index = ff->second;
         else
@@ -52,6 +52,37 @@ void VowpalWabbitReader::readLine(std::string& line, std::vector<Label>& lLabels
     for (auto& f : tmpLFeatures) lFeatures.push_back({f.first, f.second});
 }
 
+// Reads line in VowpalWabbit format using only labels and features seen during training,
+// unknown ones are skipped since the model has no weights for them
+void VowpalWabbitReader::readKnownLine(std::string& line, std::vector<Label>& lLabels,
+                                       std::vector<Feature>& lFeatures) const {
+    auto tokens = split(line, '|');
+    auto labels = split(tokens[0], ',');
+    auto features = split(tokens[1], ' ');
+
+    for (const auto& l : labels) {
+        auto fl = labelsMap.find(l);
+        if (fl != labelsMap.end()) lLabels.push_back(fl->second);
+    }
+
+    UnorderedMap<int, double> tmpLFeatures;
+    for (auto& f : features) {
+        std::string sIndex = f;
+        double value = 1.0;
+
+        size_t pos = f.find_first_of(':');
+        if (pos != std::string::npos) {
+            sIndex = f.substr(0, pos);
+            value = std::stof(f.substr(pos + 1, f.length() - pos));
+        }
+
+        auto ff = featuresMap.find(sIndex);
+        if (ff != featuresMap.end()) tmpLFeatures[ff->second] += value;
+    }
+
+    for (auto& f : tmpLFeatures) lFeatures.push_back({f.first, f.second});
+}
+
 void VowpalWabbitReader::save(std::ostream& out) {
     DataReader::save(out);
 
@@ -15,6 +15,7 @@ public:
     ~VowpalWabbitReader() override;
 
     void readLine(std::string& line, std::vector<Label>& lLabels, std::vector<Feature>& lFeatures) override;
+    void readKnownLine(std::string& line, std::vector<Label>& lLabels, std::vector<Feature>& lFeatures) const override;
 
     void save(std::ostream& out) override;
     void load(std::istream& in) override;
@@ -5,19 +5,36 @@
 
 #pragma once
 
-#include <unordered_map>
-#include <unordered_set>
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
 
 #include "model.h"
+#include "threads.h"
+
+// Members are tracked with bits of 64-bit mask
+const int maxEnsembleSize = 64;
+
+// Rows are claimed by the threads in chunks of this size when scoring missing labels
+const int missingScoresChunkSize = 16;
 
 struct EnsemblePrediction {
     int label;
     double value;
-    std::vector<int> members;
+    uint64_t members; // Mask of members that predicted the label
 
     bool operator<(const EnsemblePrediction& r) const { return value < r.value; }
 };
 
+typedef UnorderedMap<int, EnsemblePrediction> EnsemblePredictions;
+
+// Data points assigned to the nodes of member's tree
+struct EnsembleMemberTrainingData {
+    std::vector<std::vector<double>> binLabels;
+    std::vector<std::vector<Feature*>> binFeatures;
+    std::vector<std::vector<double>*>* binWeights = nullptr;
+    std::vector<std::vector<double>>* binNorms = nullptr;
+};
 
 template <typename T> class Ensemble : public Model {
 public:
@@ -25,11 +42,13 @@ public:
     ~Ensemble() override;
 
     void train(SRMatrix<Label>& labels, SRMatrix<Feature>& features, Args& args, std::string output) override;
-    void predict(std::vector<Prediction>& prediction, Feature* features, Args& args) override;
-    double predictForLabel(Label label, Feature* features, Args& args) override;
-    std::vector<std::vector<Prediction>> predictBatch(SRMatrix<Feature>& features, Args& args) override;
+    void predict(std::vector<Prediction>& prediction, Feature* features, const PredictOptions& options) const override;
+    double predictForLabel(Label label, Feature* features, const PredictOptions& options) const override;
+    std::vector<std::vector<Prediction>> predictBatch(SRMatrix<Feature>& features,
+                                                      const PredictOptions& options) const override;
 
-    void predictWithThresholds(std::vector<Prediction>& prediction, Feature* features, Args& args) override;
+    void predictWithThresholds(std::vector<Prediction>& prediction, Feature* features,
+                               const PredictOptions& options) const override;
 
     void load(Args& args, std::string infile) override;
 
@@ -37,9 +56,24 @@ public:
 
 protected:
     std::vector<T*> members;
-    T* loadMember(Args& args, const std::string& infile, int memberNo);
-    void accumulatePrediction(std::unordered_map<int, EnsemblePrediction>& ensemblePredictions,
-                              std::vector<Prediction>& prediction, int memberNo);
+    // Args and directory the ensemble was loaded with, members are loaded again with them for on the trot prediction
+    Args loadArgs;
+    std::string loadDir;
+
+    T* loadMember(Args& args, const std::string& infile, int memberNo) const;
+    static void accumulatePrediction(EnsemblePredictions& ensemblePredictions, std::vector<Prediction>& prediction,
+                                     int memberNo);
+    static void collectMissing(EnsemblePredictions& ensemblePredictions, int memberNo,
+                               std::vector<EnsemblePrediction*>& missing, std::vector<Label>& labels);
+    static void addMissingScores(EnsemblePredictions& ensemblePredictions, T* member, int memberNo, Feature* features,
+                                 const PredictOptions& options);
+    static void selectTopK(std::vector<Prediction>& prediction, EnsemblePredictions& ensemblePredictions, int size,
+                           const PredictOptions& options);
+
+    static void prepareMembersThread(int threadId, std::vector<EnsembleMemberTrainingData>& data,
+                                     std::vector<Args>& membersArgs, SRMatrix<Label>& labels,
+                                     SRMatrix<Feature>& features, SRMatrix<Feature>* labelsFeatures,
+                                     std::string output, int threads);
 };
 
 
@@ -50,109 +84,217 @@ template <typename T> Ensemble<T>::~Ensemble() {
 }
 
 template <typename T>
-void Ensemble<T>::train(SRMatrix<Label>& labels, SRMatrix<Feature>& features, Args& args, std::string output) {
-    std::cerr << "Training ensemble of " << args.ensemble << " models ...\n";
-
-    for (int i = 0; i < args.ensemble; ++i) {
+void Ensemble<T>::prepareMembersThread(int threadId, std::vector<EnsembleMemberTrainingData>& data,
+                                       std::vector<Args>& membersArgs, SRMatrix<Label>& labels,
+                                       SRMatrix<Feature>& features, SRMatrix<Feature>* labelsFeatures,
+                                       std::string output, int threads) {
+    for (int i = threadId; i < data.size(); i += threads) {
         std::string memberDir = joinPath(output, "member_" + std::to_string(i));
         makeDir(memberDir);
         T* member = new T();
-        member->train(labels, features, args, memberDir);
+        member->prepareTraining(data[i].binLabels, data[i].binFeatures, data[i].binWeights, data[i].binNorms, labels,
+                                features, membersArgs[i], memberDir, labelsFeatures);
         delete member;
     }
 }
 
 template <typename T>
-void Ensemble<T>::accumulatePrediction(std::unordered_map<int, EnsemblePrediction>& ensemblePredictions,
-                                       std::vector<Prediction>& prediction, int memberNo) {
+void Ensemble<T>::train(SRMatrix<Label>& labels, SRMatrix<Feature>& features, Args& args, std::string output) {
+    std::cerr << "Training ensemble of " << args.ensemble << " models ...\n";
+
+    // Labels' features matrix depends only on the data, so it is computed once for all the members
+    SRMatrix<Feature> labelsFeatures;
+    SRMatrix<Feature>* sharedLabelsFeatures = nullptr;
+    if (args.treeType == hierarchicalKMeans && args.treeStructure.empty()) {
+        computeLabelsFeaturesMatrix(labelsFeatures, labels, features, args.threads, args.norm,
+                                    args.kMeansWeightedFeatures);
+        sharedLabelsFeatures = &labelsFeatures;
+    }
 
+    // Trees of the members are built concurrently, each member gets its own seed and share of the threads
+    int threads = std::min(args.threads, args.ensemble);
+    std::vector<Args> membersArgs(args.ensemble, args);
+    for (auto& mArgs : membersArgs) {
+        mArgs.setSeed(args.getSeed());
+        mArgs.threads = std::max(1, args.threads / threads);
+    }
+
+    std::vector<EnsembleMemberTrainingData> data(args.ensemble);
+    ThreadSet tSet;
+    for (int t = 0; t < threads; ++t)
+        tSet.add(prepareMembersThread, t, std::ref(data), std::ref(membersArgs), std::ref(labels),
+                 std::ref(features), sharedLabelsFeatures, output, threads);
+    tSet.joinAll();
+    labelsFeatures.clear();
+
+    // Bases of all the members are trained together
+    std::vector<std::string> outfiles;
+    std::vector<int> sizes;
+    std::vector<std::vector<double>> binLabels;
+    std::vector<std::vector<Feature*>> binFeatures;
+    std::vector<std::vector<double>*>* binWeights = nullptr;
+    std::vector<std::vector<double>>* binNorms = nullptr;
+    if (data[0].binWeights != nullptr) binWeights = new std::vector<std::vector<double>*>();
+    if (data[0].binNorms != nullptr) binNorms = new std::vector<std::vector<double>>();
+
+    for (int i = 0; i < args.ensemble; ++i) {
+        outfiles.push_back(joinPath(joinPath(output, "member_" + std::to_string(i)), "weights.bin"));
+        sizes.push_back(data[i].binLabels.size());
+        std::move(data[i].binLabels.begin(), data[i].binLabels.end(), std::back_inserter(binLabels));
+        std::move(data[i].binFeatures.begin(), data[i].binFeatures.end(), std::back_inserter(binFeatures));
+        if (binWeights != nullptr) {
+            binWeights->insert(binWeights->end(), data[i].binWeights->begin(), data[i].binWeights->end());
+            delete data[i].binWeights;
+        }
+        if (binNorms != nullptr) {
+            std::move(data[i].binNorms->begin(), data[i].binNorms->end(), std::back_inserter(*binNorms));
+            delete data[i].binNorms;
+        }
+    }
+    data.clear();
+
+    trainBases(outfiles, sizes, features.cols(), binLabels, binFeatures, binWeights, binNorms, args);
+    T::freeTrainingData(binWeights, binNorms);
+}
+
+template <typename T>
+void Ensemble<T>::accumulatePrediction(EnsemblePredictions& ensemblePredictions, std::vector<Prediction>& prediction,
+                                       int memberNo) {
     for (auto& mP : prediction) {
         auto ensP = ensemblePredictions.find(mP.label);
         if (ensP != ensemblePredictions.end()) {
             ensP->second.value += mP.value;
-            ensP->second.members.push_back(memberNo);
+            ensP->second.members |= uint64_t(1) << memberNo;
         } else
-            ensemblePredictions.insert({mP.label, {mP.label, mP.value, {memberNo}}});
+            ensemblePredictions[mP.label] = {mP.label, mP.value, uint64_t(1) << memberNo};
     }
 }
 
-template <typename T> void Ensemble<T>::predict(std::vector<Prediction>& prediction, Feature* features, Args& args) {
-
-    std::unordered_map<int, EnsemblePrediction> ensemblePredictions;
-    for (size_t i = 0; i < members.size(); ++i) {
-        prediction.clear();
-        members[i]->predict(prediction, features, args);
-        accumulatePrediction(ensemblePredictions, prediction, i);
+template <typename T>
+void Ensemble<T>::collectMissing(EnsemblePredictions& ensemblePredictions, int memberNo,
+                                 std::vector<EnsemblePrediction*>& missing, std::vector<Label>& labels) {
+    for (auto& p : ensemblePredictions) {
+        if (!(p.second.members & (uint64_t(1) << memberNo))) {
+            missing.push_back(&p.second);
+            labels.push_back(p.second.label);
+        }
     }
+}
 
+template <typename T>
+void Ensemble<T>::addMissingScores(EnsemblePredictions& ensemblePredictions, T* member, int memberNo,
+                                   Feature* features, const PredictOptions& options) {
+
+    // Scores of all the labels missing in member's prediction are computed in one call
+    std::vector<EnsemblePrediction*> missing;
+    std::vector<Label> labels;
+    collectMissing(ensemblePredictions, memberNo, missing, labels);
+    if (labels.empty()) return;
+
+    std::vector<double> values;
+    member->predictForLabels(values, labels, features, options);
+    for (size_t i = 0; i < missing.size(); ++i) missing[i]->value += values[i];
+}
+
+template <typename T>
+void Ensemble<T>::selectTopK(std::vector<Prediction>& prediction, EnsemblePredictions& ensemblePredictions, int size,
+                             const PredictOptions& options) {
     prediction.clear();
-    for (auto& p : ensemblePredictions) {
-        if(args.ensMissingScores) {
-            for (size_t i = 0; i < members.size(); ++i) {
-                if (!std::count(p.second.members.begin(), p.second.members.end(), i))
-                    p.second.value += members[i]->predictForLabel(p.second.label, features, args);
-            }
-        }
-        prediction.push_back({p.second.label, p.second.value / members.size()});
+    prediction.reserve(ensemblePredictions.size());
+    for (auto& p : ensemblePredictions) prediction.push_back({p.second.label, p.second.value / size});
+
+    if (options.topK > 0 && options.topK < prediction.size()) {
+        std::partial_sort(prediction.begin(), prediction.begin() + options.topK, prediction.end(),
+                          [](const Prediction& a, const Prediction& b) { return a.value > b.value; });
+        prediction.resize(options.topK);
+    } else
+        sort(prediction.rbegin(), prediction.rend());
+}
+
+template <typename T>
+void Ensemble<T>::predict(std::vector<Prediction>& prediction, Feature* features, const PredictOptions& options) const {
+    // Members are evaluated by the shared pool of threads, or in the calling thread if it already belongs to it,
+    // results are combined in members' order
+    int size = members.size();
+    std::vector<std::vector<Prediction>> memberPredictions(size);
+    processRowsInChunks(size, 1, options.threads, [&](int start, int stop) {
+        for (int i = start; i < stop; ++i) members[i]->predict(memberPredictions[i], features, options);
+    });
+
+    EnsemblePredictions ensemblePredictions;
+    for (int i = 0; i < size; ++i) accumulatePrediction(ensemblePredictions, memberPredictions[i], i);
+
+    if (options.ensMissingScores) {
+        std::vector<std::vector<EnsemblePrediction*>> missing(size);
+        std::vector<std::vector<Label>> labels(size);
+        std::vector<std::vector<double>> values(size);
+        for (int i = 0; i < size; ++i) collectMissing(ensemblePredictions, i, missing[i], labels[i]);
+
+        processRowsInChunks(size, 1, options.threads, [&](int start, int stop) {
+            for (int i = start; i < stop; ++i)
+                if (!labels[i].empty()) members[i]->predictForLabels(values[i], labels[i], features, options);
+        });
+
+        for (int i = 0; i < size; ++i)
+            for (size_t j = 0; j < missing[i].size(); ++j) missing[i][j]->value += values[i][j];
     }
 
-    sort(prediction.rbegin(), prediction.rend());
-    if (args.topK > 0) prediction.resize(args.topK);
+    selectTopK(prediction, ensemblePredictions, members.size(), options);
 }
 
-template <typename T> double Ensemble<T>::predictForLabel(Label label, Feature* features, Args& args) {
+template <typename T>
+double Ensemble<T>::predictForLabel(Label label, Feature* features, const PredictOptions& options) const {
     double value = 0;
-    for (auto& m : members) value += m->predictForLabel(label, features, args);
+    for (auto& m : members) value += m->predictForLabel(label, features, options);
     return value / members.size();
 }
 
 template <typename T>
-std::vector<std::vector<Prediction>> Ensemble<T>::predictBatch(SRMatrix<Feature>& features, Args& args) {
-    if (!args.onTheTrotPrediction) return Model::predictBatch(features, args);
-
+std::vector<std::vector<Prediction>> Ensemble<T>::predictBatch(SRMatrix<Feature>& features,
+                                                               const PredictOptions& options) const {
+    // Batch is predicted member by member, so each member can use its own batch prediction
     int rows = features.rows();
-    std::vector<std::unordered_map<int, EnsemblePrediction>> ensemblePredictions(rows);
+    std::vector<EnsemblePredictions> ensemblePredictions(rows);
+
+    bool onTheTrot = loadArgs.onTheTrotPrediction;
+    int size = loadArgs.ensemble;
+    Args memberArgs = loadArgs;
+    auto getMember = [&](int memberNo) {
+        return onTheTrot ? loadMember(memberArgs, loadDir, memberNo) : members[memberNo];
+    };
 
     // Get top predictions for members
-    for (int memberNo = 0; memberNo < args.ensemble; ++memberNo) {
-        T* member = loadMember(args, args.output, memberNo);
+    for (int memberNo = 0; memberNo < size; ++memberNo) {
+        T* member = getMember(memberNo);
 
-        std::vector<std::vector<Prediction>> memberPredictions = member->predictBatch(features, args);
+        std::vector<std::vector<Prediction>> memberPredictions = member->predictBatch(features, options);
         for (int i = 0; i < rows; ++i) accumulatePrediction(ensemblePredictions[i], memberPredictions[i], memberNo);
 
-        delete member;
+        if (onTheTrot) delete member;
     }
 
     // Predict missing predictions for specific labels
-    if(args.ensMissingScores) {
-        for (int memberNo = 0; memberNo < args.ensemble; ++memberNo) {
-            T *member = loadMember(args, args.output, memberNo);
-
-            for (int i = 0; i < rows; ++i) {
-                printProgress(i, rows);
-                for (auto &p : ensemblePredictions[i]) {
-                    if (!std::count(p.second.members.begin(), p.second.members.end(), memberNo))
-                        p.second.value += member->predictForLabel(p.second.label, features[i], args);
-                }
-            }
-
-            delete member;
+    if(options.ensMissingScores) {
+        for (int memberNo = 0; memberNo < size; ++memberNo) {
+            T* member = getMember(memberNo);
+
+            processRowsInChunks(rows, missingScoresChunkSize, options.threads, [&](int start, int stop) {
+                for (int r = start; r < stop; ++r)
+                    addMissingScores(ensemblePredictions[r], member, memberNo, features[r], options);
+            });
+
+            if (onTheTrot) delete member;
         }
     }
 
     // Create final predictions
     std::vector<std::vector<Prediction>> predictions(rows);
-    for (int i = 0; i < rows; ++i) {
-        for (auto& p : ensemblePredictions[i])
-            predictions[i].push_back({p.second.label, p.second.value / args.ensemble});
-        sort(predictions[i].rbegin(), predictions[i].rend());
-        if (args.topK > 0) predictions[i].resize(args.topK);
-    }
+    for (int i = 0; i < rows; ++i) selectTopK(predictions[i], ensemblePredictions[i], size, options);
 
     return predictions;
 }
 
-template <typename T> T* Ensemble<T>::loadMember(Args& args, const std::string& infile, int memberNo) {
+template <typename T> T* Ensemble<T>::loadMember(Args& args, const std::string& infile, int memberNo) const {
     std::cerr << "  Loading ensemble member number " << memberNo << " ...\n";
     assert(memberNo < args.ensemble);
     T* member = new T();
@@ -161,6 +303,8 @@ template <typename T> T* Ensemble<T>::loadMember(Args& args, const std::string&
 }
 
 template <typename T> void Ensemble<T>::load(Args& args, std::string infile) {
+    loadArgs = args;
+    loadDir = infile;
     if (!args.onTheTrotPrediction) {
         std::cerr << "Loading ensemble of " << args.ensemble << " models ...\n";
         for (int i = 0; i < args.ensemble; ++i) members.push_back(loadMember(args, infile, i));
@@ -175,6 +319,8 @@ template <typename T> void Ensemble<T>::load(Args& args, std::string infile) {
 template <typename T> void Ensemble<T>::printInfo() {}
 
 
-template <typename T> void Ensemble<T>::predictWithThresholds(std::vector<Prediction>& prediction, Feature* features, Args& args){
+template <typename T>
+void Ensemble<T>::predictWithThresholds(std::vector<Prediction>& prediction, Feature* features,
+                                        const PredictOptions& options) const {
     std::cerr << "  Threshold prediction is not available for ensemble";
 }
\ No newline at end of file
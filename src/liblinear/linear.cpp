@@ -78,6 +78,43 @@ public:
 			x++;
 		}
 	}
+
+	// Variant with x scaled by labels y (of instances indexed by x->index)
+	static void axpy_y(const double a, const feature_node *x, const schar *y, double *b)
+	{
+		while(x->index != -1)
+		{
+			b[x->index-1] += a*(y[x->index-1]*x->value);
+			x++;
+		}
+	}
+
+	// Variants for nr_block weight vectors interleaved as s[j*nr_block+k]
+	static void dot_block(const double *s, int nr_block, const feature_node *x, double *ret)
+	{
+		for(int k=0; k<nr_block; k++)
+			ret[k] = 0;
+		while(x->index != -1)
+		{
+			const double *sx = s + (size_t)(x->index-1)*nr_block;
+			const double v = x->value;
+			for(int k=0; k<nr_block; k++)
+				ret[k] += sx[k]*v;
+			x++;
+		}
+	}
+
+	static void axpy_block(const double *a, int nr_block, const feature_node *x, double *y)
+	{
+		while(x->index != -1)
+		{
+			double *yx = y + (size_t)(x->index-1)*nr_block;
+			const double v = x->value;
+			for(int k=0; k<nr_block; k++)
+				yx[k] += a[k]*v;
+			x++;
+		}
+	}
 };
 
 class l2r_lr_fun: public function
@@ -883,8 +920,9 @@ static void solve_l2r_l1l2_svc(
 		QD[i] = diag[GETI(i)];
 
 		feature_node * const xi = prob->x[i];
-		QD[i] += sparse_operator::nrm2_sq(xi);
-		sparse_operator::axpy(y[i]*alpha[i], xi, w);
+		QD[i] += prob->xTx != NULL ? prob->xTx[i] : sparse_operator::nrm2_sq(xi);
+		if(alpha[i] != 0)
+			sparse_operator::axpy(y[i]*alpha[i], xi, w);
 
 		index[i] = i;
 	}
@@ -1083,8 +1121,9 @@ static void solve_l2r_l1l2_svr(
 	for(i=0; i<l; i++)
 	{
 		feature_node * const xi = prob->x[i];
-		QD[i] = sparse_operator::nrm2_sq(xi);
-		sparse_operator::axpy(beta[i], xi, w);
+		QD[i] = prob->xTx != NULL ? prob->xTx[i] : sparse_operator::nrm2_sq(xi);
+		if(beta[i] != 0)
+			sparse_operator::axpy(beta[i], xi, w);
 
 		index[i] = i;
 	}
@@ -1293,7 +1332,7 @@ void solve_l2r_lr_dual(const problem *prob, double *w, double eps, double Cp, do
 	for(i=0; i<l; i++)
 	{
 		feature_node * const xi = prob->x[i];
-		xTx[i] = sparse_operator::nrm2_sq(xi);
+		xTx[i] = prob->xTx != NULL ? prob->xTx[i] : sparse_operator::nrm2_sq(xi);
 		sparse_operator::axpy(y[i]*alpha[2*i], xi, w);
 		index[i] = i;
 	}
@@ -1394,6 +1433,201 @@ void solve_l2r_lr_dual(const problem *prob, double *w, double eps, double Cp, do
 	delete [] index;
 }
 
+// Block variant of solve_l2r_lr_dual for nr_block problems sharing
+// the instances x (and their weights W), that differ only in labels.
+// One pass over an instance updates the dual variables of all problems,
+// so x is streamed once per iteration for the whole block.
+//
+// Given:
+// x, W, y[k] (y[k][i] > 0 for positive instances), Cp[k], Cn[k]
+// eps is the stopping tolerance checked for each problem separately
+//
+// solution of the k-th problem will be put in w[j*nr_block+k]
+
+void solve_l2r_lr_dual_block(const problem *prob, const double * const *y, int nr_block, double *w, double eps,
+	const double *Cp, const double *Cn, int max_iter)
+{
+	int l = prob->l;
+	int w_size = prob->n;
+	int B = nr_block;
+	int i, k, s, iter = 0;
+	size_t ik;
+	double *xTx = new double[l];
+	int *index = new int[l];
+	double *alpha = new double[2*(size_t)l*B]; // store alpha and C - alpha, instance-major
+	schar *yb = new schar[(size_t)l*B];
+	double *upper_bound = new double[(size_t)l*B];
+	double *innereps = new double[B];
+	double *Gmax = new double[B];
+	int *newton_iter = new int[B];
+	schar *active = new schar[B];
+	double *wTx = new double[B];
+	double *d = new double[B];
+	int max_inner_iter = 100; // for inner Newton
+	double innereps_min = min(1e-8, eps);
+	int active_size = 0;
+	int nr_active = B;
+
+	for(i=0; i<l; i++)
+	{
+		for(k=0; k<B; k++)
+		{
+			ik = (size_t)i*B+k;
+			if(y[k][i] > 0)
+			{
+				upper_bound[ik] = prob->W[i] * Cp[k];
+				yb[ik] = +1;
+			}
+			else
+			{
+				upper_bound[ik] = prob->W[i] * Cn[k];
+				yb[ik] = -1;
+			}
+
+			alpha[2*ik] = min(0.001*upper_bound[ik], 1e-8);
+			alpha[2*ik+1] = upper_bound[ik] - alpha[2*ik];
+		}
+	}
+
+	for(ik=0; ik<(size_t)w_size*B; ik++)
+		w[ik] = 0;
+	for(i=0; i<l; i++)
+	{
+		feature_node * const xi = prob->x[i];
+		xTx[i] = prob->xTx != NULL ? prob->xTx[i] : sparse_operator::nrm2_sq(xi);
+		for(k=0; k<B; k++)
+		{
+			ik = (size_t)i*B+k;
+			d[k] = yb[ik]*alpha[2*ik];
+		}
+		sparse_operator::axpy_block(d, B, xi, w);
+
+		// Zero weighted instances are skipped like in remove_zero_weight
+		if(prob->W[i] > 0)
+			index[active_size++] = i;
+	}
+
+	for(k=0; k<B; k++)
+	{
+		innereps[k] = 1e-2;
+		active[k] = 1;
+	}
+
+	while (iter < max_iter && nr_active > 0)
+	{
+		for (i=0; i<active_size; i++)
+		{
+			int j = i+rand()%(active_size-i);
+			swap(index[i], index[j]);
+		}
+		for(k=0; k<B; k++)
+		{
+			newton_iter[k] = 0;
+			Gmax[k] = 0;
+		}
+		for (s=0; s<active_size; s++)
+		{
+			i = index[s];
+			feature_node * const xi = prob->x[i];
+			double xisq = xTx[i];
+			bool update = false;
+			sparse_operator::dot_block(w, B, xi, wTx);
+
+			for(k=0; k<B; k++)
+			{
+				d[k] = 0;
+				if(!active[k])
+					continue;
+
+				ik = (size_t)i*B+k;
+				const schar yi = yb[ik];
+				double C = upper_bound[ik];
+				double a = xisq, b = yi*wTx[k];
+
+				// Decide to minimize g_1(z) or g_2(z)
+				size_t ind1 = 2*ik, ind2 = 2*ik+1;
+				int sign = 1;
+				if(0.5*a*(alpha[ind2]-alpha[ind1])+b < 0)
+				{
+					ind1 = 2*ik+1;
+					ind2 = 2*ik;
+					sign = -1;
+				}
+
+				//  g_t(z) = z*log(z) + (C-z)*log(C-z) + 0.5a(z-alpha_old)^2 + sign*b(z-alpha_old)
+				double alpha_old = alpha[ind1];
+				double z = alpha_old;
+				if(C - z < 0.5 * C)
+					z = 0.1*z;
+				double gp = a*(z-alpha_old)+sign*b+log(z/(C-z));
+				Gmax[k] = max(Gmax[k], fabs(gp));
+
+				// Newton method on the sub-problem
+				const double eta = 0.1; // xi in the paper
+				int inner_iter = 0;
+				while (inner_iter <= max_inner_iter)
+				{
+					if(fabs(gp) < innereps[k])
+						break;
+					double gpp = a + C/(C-z)/z;
+					double tmpz = z - gp/gpp;
+					if(tmpz <= 0)
+						z *= eta;
+					else // tmpz in (0, C)
+						z = tmpz;
+					gp = a*(z-alpha_old)+sign*b+log(z/(C-z));
+					newton_iter[k]++;
+					inner_iter++;
+				}
+
+				if(inner_iter > 0)
+				{
+					alpha[ind1] = z;
+					alpha[ind2] = C-z;
+					d[k] = sign*(z-alpha_old)*yi;
+					update = true;
+				}
+			}
+
+			if(update) // update w of all problems at once
+				sparse_operator::axpy_block(d, B, xi, w);
+		}
+
+		iter++;
+		if(iter % 10 == 0)
+			info(".");
+
+		for(k=0; k<B; k++)
+		{
+			if(!active[k])
+				continue;
+			if(Gmax[k] < eps)
+			{
+				active[k] = 0;
+				nr_active--;
+			}
+			else if(newton_iter[k] <= active_size/10)
+				innereps[k] = max(innereps_min, 0.1*innereps[k]);
+		}
+	}
+
+	info("\noptimization finished, #iter = %d\n",iter);
+	if (iter >= max_iter)
+		info("\nWARNING: reaching max number of iterations\n");
+
+	delete [] d;
+	delete [] wTx;
+	delete [] active;
+	delete [] newton_iter;
+	delete [] Gmax;
+	delete [] innereps;
+	delete [] upper_bound;
+	delete [] yb;
+	delete [] alpha;
+	delete [] index;
+	delete [] xTx;
+}
+
 // A coordinate descent algorithm for
 // L1-regularized L2-loss support vector classification
 //
@@ -1464,8 +1698,7 @@ static void solve_l1r_l2_svc(
 		while(x->index != -1)
 		{
 			int ind = x->index-1;
-			x->value *= y[ind]; // x->value stores yi*xij
-			double val = x->value;
+			double val = y[ind]*x->value; // x is not modified, so it can be shared
 			b[ind] -= w[j]*val;
 			xj_sq[j] += C[GETI(ind)]*val*val;
 			x++;
@@ -1495,7 +1728,7 @@ static void solve_l1r_l2_svc(
 				int ind = x->index-1;
 				if(b[ind] > 0)
 				{
-					double val = x->value;
+					double val = y[ind]*x->value;
 					double tmp = C[GETI(ind)]*val;
 					G_loss -= tmp*b[ind];
 					H += tmp*val;
@@ -1556,7 +1789,7 @@ static void solve_l1r_l2_svc(
 				if(appxcond <= 0)
 				{
 					x = prob_col->x[j];
-					sparse_operator::axpy(d_diff, x, b);
+					sparse_operator::axpy_y(d_diff, x, y, b);
 					break;
 				}
 
@@ -1570,7 +1803,7 @@ static void solve_l1r_l2_svc(
 						int ind = x->index-1;
 						if(b[ind] > 0)
 							loss_old += C[GETI(ind)]*b[ind]*b[ind];
-						double b_new = b[ind] + d_diff*x->value;
+						double b_new = b[ind] + d_diff*(y[ind]*x->value);
 						b[ind] = b_new;
 						if(b_new > 0)
 							loss_new += C[GETI(ind)]*b_new*b_new;
@@ -1584,7 +1817,7 @@ static void solve_l1r_l2_svc(
 					while(x->index != -1)
 					{
 						int ind = x->index-1;
-						double b_new = b[ind] + d_diff*x->value;
+						double b_new = b[ind] + d_diff*(y[ind]*x->value);
 						b[ind] = b_new;
 						if(b_new > 0)
 							loss_new += C[GETI(ind)]*b_new*b_new;
@@ -1616,7 +1849,7 @@ static void solve_l1r_l2_svc(
 				{
 					if(w[i]==0) continue;
 					x = prob_col->x[i];
-					sparse_operator::axpy(-w[i], x, b);
+					sparse_operator::axpy_y(-w[i], x, y, b);
 				}
 			}
 		}
@@ -1653,12 +1886,6 @@ static void solve_l1r_l2_svc(
 	int nnz = 0;
 	for(j=0; j<w_size; j++)
 	{
-		x = prob_col->x[j];
-		while(x->index != -1)
-		{
-			x->value *= prob_col->y[x->index-1]; // restore x->value
-			x++;
-		}
 		if(w[j] != 0)
 		{
 			v += fabs(w[j]);
@@ -2058,19 +2285,18 @@ static void solve_l1r_lr(
 }
 
 // transpose matrix X from row format to column format
+// if columns of X are already given in prob->x_col, only their pointers are copied
 static void transpose(const problem *prob, feature_node **x_space_ret, problem *prob_col)
 {
 	int i;
 	int l = prob->l;
 	int n = prob->n;
-	size_t nnz = 0;
-	size_t *col_ptr = new size_t [n+1];
-	feature_node *x_space;
 	prob_col->l = l;
 	prob_col->n = n;
 	prob_col->y = new double[l];
-	prob_col->x = new feature_node*[n];
 	prob_col->W = new double[l];
+	prob_col->xTx = NULL;
+	prob_col->x_col = NULL;
 
 	for(i=0; i<l; i++)
 	{
@@ -2078,6 +2304,27 @@ static void transpose(const problem *prob, feature_node **x_space_ret, problem *
 		prob_col->W[i] = prob->W[i];
 	}
 
+	if(prob->x_col != NULL)
+	{
+		prob_col->x = new feature_node*[n];
+		for(i=0; i<n; i++)
+			prob_col->x[i] = prob->x_col[i];
+		*x_space_ret = NULL;
+	}
+	else
+		transpose_instances(prob, &prob_col->x, x_space_ret);
+}
+
+void transpose_instances(const problem *prob, feature_node ***x_col_ret, feature_node **x_space_ret)
+{
+	int i;
+	int l = prob->l;
+	int n = prob->n;
+	size_t nnz = 0;
+	size_t *col_ptr = new size_t [n+1];
+	feature_node **x_col = new feature_node*[n];
+	feature_node *x_space;
+
 	for(i=0; i<n+1; i++)
 		col_ptr[i] = 0;
 	for(i=0; i<l; i++)
@@ -2095,7 +2342,7 @@ static void transpose(const problem *prob, feature_node **x_space_ret, problem *
 
 	x_space = new feature_node[nnz+n];
 	for(i=0; i<n; i++)
-		prob_col->x[i] = &x_space[col_ptr[i]];
+		x_col[i] = &x_space[col_ptr[i]];
 
 	for(i=0; i<l; i++)
 	{
@@ -2112,6 +2359,7 @@ static void transpose(const problem *prob, feature_node **x_space_ret, problem *
 	for(i=0; i<n; i++)
 		x_space[col_ptr[i]].index = -1;
 
+	*x_col_ret = x_col;
 	*x_space_ret = x_space;
 
 	delete [] col_ptr;
@@ -2501,6 +2749,8 @@ static void remove_zero_weight(problem *newprob, const problem *prob)
 	newprob->x = Malloc(feature_node*,l);
 	newprob->y = Malloc(double,l);
 	newprob->W = Malloc(double,l);
+	if(prob->xTx != NULL)
+		newprob->xTx = Malloc(double,l);
 
 	int j = 0;
 	for(i=0;i<prob->l;i++)
@@ -2509,6 +2759,8 @@ static void remove_zero_weight(problem *newprob, const problem *prob)
 			newprob->x[j] = prob->x[i];
 			newprob->y[j] = prob->y[i];
 			newprob->W[j] = prob->W[i];
+			if(prob->xTx != NULL)
+				newprob->xTx[j] = prob->xTx[i];
 			j++;
 		}
 }
@@ -2520,6 +2772,8 @@ model* train_liblinear(const problem *prob, const parameter *param)
 {
 	problem newprob;
 	remove_zero_weight(&newprob, prob);
+	if(newprob.l != prob->l) // cached columns index the removed instances
+		newprob.x_col = NULL;
 	prob = &newprob;
 	int i,j;
 	int l = prob->l;
@@ -2560,6 +2814,11 @@ model* train_liblinear(const problem *prob, const parameter *param)
 		// group training data of the same class
 		group_classes(prob,&nr_class,&label,&start,&count,perm);
 
+		// cached columns index instances in the original order, L1 solvers do not need them grouped
+		if(prob->x_col != NULL && (param->solver_type == L1R_L2LOSS_SVC || param->solver_type == L1R_LR))
+			for(i=0;i<l;i++)
+				perm[i] = i;
+
 		model_->nr_class=nr_class;
 		model_->label = Malloc(int,nr_class);
 		for(i=0;i<nr_class;i++)
@@ -2592,9 +2851,15 @@ model* train_liblinear(const problem *prob, const parameter *param)
 		sub_prob.x = Malloc(feature_node *,sub_prob.l);
 		sub_prob.y = Malloc(double,sub_prob.l);
 		sub_prob.W = Malloc(double,sub_prob.l);
+		sub_prob.xTx = NULL;
+		sub_prob.x_col = prob->x_col;
+		if(prob->xTx != NULL)
+			sub_prob.xTx = Malloc(double,sub_prob.l);
 		for(k=0; k<sub_prob.l; k++){
 			sub_prob.x[k] = x[k];
 			sub_prob.W[k] = prob->W[perm[k]];
+			if(prob->xTx != NULL)
+				sub_prob.xTx[k] = prob->xTx[perm[k]];
 		}
 
 		// multi-class svm by Crammer and Singer
@@ -2613,12 +2878,8 @@ model* train_liblinear(const problem *prob, const parameter *param)
 			{
 				model_->w=Malloc(double, w_size);
 
-				int e0 = start[0]+count[0];
-				k=0;
-				for(; k<e0; k++)
-					sub_prob.y[k] = +1;
-				for(; k<sub_prob.l; k++)
-					sub_prob.y[k] = -1;
+				for(k=0; k<sub_prob.l; k++)
+					sub_prob.y[k] = ((int)prob->y[perm[k]] == label[0]) ? +1 : -1;
 
 				if(param->init_sol != NULL)
 					for(i=0;i<w_size;i++)
@@ -2635,16 +2896,8 @@ model* train_liblinear(const problem *prob, const parameter *param)
 				double *w=Malloc(double, w_size);
 				for(i=0;i<nr_class;i++)
 				{
-					int si = start[i];
-					int ei = si+count[i];
-
-					k=0;
-					for(; k<si; k++)
-						sub_prob.y[k] = -1;
-					for(; k<ei; k++)
-						sub_prob.y[k] = +1;
-					for(; k<sub_prob.l; k++)
-						sub_prob.y[k] = -1;
+					for(k=0; k<sub_prob.l; k++)
+						sub_prob.y[k] = ((int)prob->y[perm[k]] == label[i]) ? +1 : -1;
 
 					if(param->init_sol != NULL)
 						for(j=0;j<w_size;j++)
@@ -2672,9 +2925,11 @@ model* train_liblinear(const problem *prob, const parameter *param)
 		free(sub_prob.y);
 		free(weighted_C);
 		free(sub_prob.W);
+		free(sub_prob.xTx);
 		free(newprob.x);
 		free(newprob.y);
 		free(newprob.W);
+		free(newprob.xTx);
 	}
 	return model_;
 }
@@ -2713,6 +2968,8 @@ void cross_validation(const problem *prob, const parameter *param, int nr_fold,
 		subprob.x = Malloc(struct feature_node*,subprob.l);
 		subprob.y = Malloc(double,subprob.l);
 		subprob.W = Malloc(double,subprob.l);
+		subprob.xTx = NULL;
+		subprob.x_col = NULL;
 
 		k=0;
 		for(j=0;j<begin;j++)
@@ -2779,6 +3036,8 @@ void find_parameters(const problem *prob, const parameter *param, int nr_fold, d
 		subprob[i].x = Malloc(struct feature_node*,subprob[i].l);
 		subprob[i].y = Malloc(double,subprob[i].l);
 		subprob[i].W = Malloc(double,subprob[i].l);
+		subprob[i].xTx = NULL;
+		subprob[i].x_col = NULL;
 		k=0;
 		for(j=0;j<begin;j++)
 		{
@@ -31,6 +31,8 @@ struct problem
 	struct feature_node **x;
 	double bias;            /* < 0 if no bias term */
 	double *W;              /* instance weight */
+	double *xTx;            /* squared norms of instances, NULL if not precomputed */
+	struct feature_node **x_col; /* columns of x (see transpose_instances), NULL if not precomputed */
 };
 
 enum { L2R_LR, L2R_L2LOSS_SVC_DUAL, L2R_L2LOSS_SVC, L2R_L1LOSS_SVC_DUAL, MCSVM_CS, L1R_L2LOSS_SVC, L1R_LR, L2R_LR_DUAL, L2R_L2LOSS_SVR = 11, L2R_L2LOSS_SVR_DUAL, L2R_L1LOSS_SVR_DUAL }; /* solver_type */
@@ -63,6 +65,9 @@ struct model
 struct model* train_liblinear(const struct problem *prob, const struct parameter *param);
 void cross_validation(const struct problem *prob, const struct parameter *param, int nr_fold, double *target);
 void find_parameters(const struct problem *prob, const struct parameter *param, int nr_fold, double start_C, double start_p, double *best_C, double *best_p, double *best_score);
+void transpose_instances(const struct problem *prob, struct feature_node ***x_col_ret, struct feature_node **x_space_ret);
+void solve_l2r_lr_dual_block(const struct problem *prob, const double * const *y, int nr_block, double *w, double eps,
+	const double *Cp, const double *Cn, int max_iter);
 
 double predict_values(const struct model *model_, const struct feature_node *x, double* dec_values);
 double predict(const struct model *model_, const struct feature_node *x);
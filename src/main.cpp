@@ -18,25 +18,10 @@
 #include "misc.h"
 #include "model.h"
 #include "resources.h"
+#include "server.h"
 #include "types.h"
 
 
-// TODO: refactor this as load/save vector
-std::vector<double> loadThresholds(std::string infile){
-    std::vector<double> thresholds;
-    std::ifstream thresholdsIn(infile);
-    double t;
-    while (thresholdsIn >> t) thresholds.push_back(t);
-    return thresholds;
-}
-
-void saveThresholds(std::vector<double>& thresholds, std::string outfile){
-    std::ofstream out(outfile);
-    for(auto t : thresholds)
-        out << t << std::endl;
-    out.close();
-}
-
 void train(Args& args) {
     SRMatrix<Label> labels;
     SRMatrix<Feature> features;
@@ -104,13 +89,14 @@ void test(Args& args) {
     auto resAfterModel = getResources();
 
     // Predict for test set
+    PredictOptions options(args);
     std::vector<std::vector<Prediction>> predictions;
     if (!args.thresholds.empty()) { // Using thresholds if provided
         std::vector<double> thresholds = loadThresholds(args.thresholds);
         model->setThresholds(thresholds);
-        predictions = model->predictBatchWithThresholds(features, args);
+        predictions = model->predictBatchWithThresholds(features, options);
     } else
-        predictions = model->predictBatch(features, args);
+        predictions = model->predictBatch(features, options);
 
     auto resAfterPrediction = getResources();
 
@@ -126,6 +112,7 @@ void test(Args& args) {
         std::cout << std::endl;
     }
     model->printInfo();
+    if (!args.metricsFile.empty()) model->saveMetrics(args.metricsFile);
 
     // Print resources
     auto loadRealTime = static_cast<double>(std::chrono::duration_cast<std::chrono::milliseconds>(
@@ -183,12 +170,13 @@ void predict(Args& args) {
             model->setThresholds(thresholds);
         }
 
+        PredictOptions options(args);
         if(args.threads > 1) {
             std::vector<std::vector<Prediction>> predictions;
             if (!args.thresholds.empty())
-                predictions = model->predictBatchWithThresholds(features, args);
+                predictions = model->predictBatchWithThresholds(features, options);
             else
-                predictions = model->predictBatch(features, args);
+                predictions = model->predictBatch(features, options);
 
             for (const auto &p : predictions) {
                 for (const auto &l : p) std::cout << l.label << ":" << l.value << " ";
@@ -200,9 +188,9 @@ void predict(Args& args) {
                 std::vector<Prediction> prediction;
 
                 if (!args.thresholds.empty())
-                    model->predictWithThresholds(prediction, features[r], args);
+                    model->predictWithThresholds(prediction, features[r], options);
                 else
-                    model->predict(prediction, features[r], args);
+                    model->predict(prediction, features[r], options);
 
                 for (const auto &l : prediction) std::cout << l.label << ":" << l.value << " ";
                 std::cout << std::endl;
@@ -246,6 +234,12 @@ void ofo(Args& args) {
               << "\n  Optimization CPU time (s): " << cpuTime << "\n";
 }
 
+void serve(Args& args) {
+    // Server loads the model, then predicts data points sent by the clients until it is stopped
+    Server server(args);
+    server.run();
+}
+
 void testPredictionTime(Args& args) {
     // Method for testing performance on different batch (test dataset) sizes
 
@@ -260,6 +254,7 @@ void testPredictionTime(Args& args) {
     // Load model
     std::shared_ptr<Model> model = Model::factory(args);
     model->load(args, args.output);
+    PredictOptions options(args);
 
     SRMatrix<Label> labels;
     SRMatrix<Feature> features;
@@ -292,10 +287,8 @@ void testPredictionTime(Args& args) {
 
             // Test batch
             double startTime = static_cast<double>(clock()) / CLOCKS_PER_SEC;
-            for (const auto& r : batch) {
-                std::vector<Prediction> prediction;
-                model->predict(prediction, r, args);
-            }
+            std::vector<std::vector<Prediction>> predictions(batch.size());
+            model->predictRows(predictions.data(), batch.data(), batch.size(), options);
 
             // Accumulate time measurements
             double stopTime = static_cast<double>(clock()) / CLOCKS_PER_SEC;
@@ -319,12 +312,32 @@ void testPredictionTime(Args& args) {
     std::cout << "\n";
 }
 
+void buildIndex(Args& args) {
+    // Load model args
+    args.loadFromFile(joinPath(args.output, "args.bin"));
+    args.printArgs();
+
+    // Build the index from the model's weights and save it in the model directory
+    std::shared_ptr<Model> model = Model::factory(args);
+    try {
+        model->saveIndex(args, args.output);
+    } catch (const std::invalid_argument& e) {
+        std::cerr << e.what() << "\n";
+        exit(EXIT_FAILURE);
+    }
+}
+
 int main(int argc, char** argv) {
     std::vector<std::string> arg(argv, argv + argc);
     Args args = Args();
 
     // Parse args
-    args.parseArgs(arg);
+    try {
+        args.parseArgs(arg);
+    } catch (const std::invalid_argument& e) {
+        std::cerr << e.what() << "\n";
+        args.printHelp();
+    }
 
     if (args.command == "train")
         train(args);
@@ -336,6 +349,10 @@ int main(int argc, char** argv) {
         ofo(args);
     else if (args.command == "testPredictionTime")
         testPredictionTime(args);
+    else if (args.command == "serve")
+        serve(args);
+    else if (args.command == "buildIndex")
+        buildIndex(args);
 
     return 0;
 }
@@ -63,7 +63,8 @@ std::vector<std::shared_ptr<Measure>> Measure::factory(Args& args, int outputSiz
             else if (m == "fn")
                 measures.push_back(std::static_pointer_cast<Measure>(std::make_shared<FalseNegatives>()));
             else if (m == "u")
-                measures.push_back(std::static_pointer_cast<Measure>(SetUtility::factory(args, outputSize)));
+                measures.push_back(
+                    std::static_pointer_cast<Measure>(SetUtility::factory(PredictOptions(args), outputSize)));
             else
                 throw std::invalid_argument("Unknown measure type: " + m + "!");
         }
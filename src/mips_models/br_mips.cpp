@@ -7,6 +7,7 @@
 #include <cassert>
 #include <climits>
 #include <cmath>
+#include <fstream>
 #include <list>
 #include <vector>
 
@@ -17,11 +18,21 @@
 BRMIPS::BRMIPS() {
     type = brMips;
     name = "BR MIPS";
+    mipsIndex = nullptr;
 }
 
-void BRMIPS::predict(std::vector<Prediction>& prediction, Feature* features, Args& args) {
+BRMIPS::~BRMIPS() { delete mipsIndex; }
 
-    std::priority_queue<Prediction> mipsPrediction = mipsIndex->predict(features, args.topK);
+void BRMIPS::train(SRMatrix<Label>& labels, SRMatrix<Feature>& features, Args& args, std::string output) {
+    BR::train(labels, features, args, output);
+
+    // Index is built once after training, so loading the model only reads it
+    saveIndex(args, output);
+}
+
+void BRMIPS::predict(std::vector<Prediction>& prediction, Feature* features, const PredictOptions& options) const {
+
+    std::priority_queue<Prediction> mipsPrediction = mipsIndex->predict(features, options.topK);
     while (!mipsPrediction.empty()) {
         auto p = mipsPrediction.top();
         mipsPrediction.pop();
@@ -29,7 +40,7 @@ void BRMIPS::predict(std::vector<Prediction>& prediction, Feature* features, Arg
     }
 }
 
-void BRMIPS::load(Args& args, std::string infile) {
+void BRMIPS::loadPoints(Args& args, std::string infile) {
     std::cerr << "Loading weights ...\n";
     bases = loadBases(joinPath(infile, "weights.bin"));
     m = bases.size();
@@ -45,6 +56,7 @@ void BRMIPS::load(Args& args, std::string infile) {
         }
     }
 
+    delete mipsIndex;
     mipsIndex = new MIPSIndex(dim, !args.mipsDense, args);
     std::cerr << "Adding " << m << " points with " << dim << " dims to MIPSIndex ...\n";
     for (int i = 0; i < m; ++i) {
@@ -55,6 +67,21 @@ void BRMIPS::load(Args& args, std::string infile) {
             else mipsIndex->addPoint(bases[i]->getW(), dim, i);
         }
     }
+}
+
+void BRMIPS::load(Args& args, std::string infile) {
+    loadPoints(args, infile);
+
+    // Index saved with the model is used if present, otherwise it has to be built
+    std::string indexFile = joinPath(infile, mipsIndex->indexFileName());
+    if (std::ifstream(indexFile).good())
+        mipsIndex->loadIndex(args, indexFile);
+    else
+        mipsIndex->createIndex(args);
+}
 
+void BRMIPS::saveIndex(Args& args, std::string infile) {
+    loadPoints(args, infile);
     mipsIndex->createIndex(args);
+    mipsIndex->saveIndex(joinPath(infile, mipsIndex->indexFileName()));
 }
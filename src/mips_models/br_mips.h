@@ -12,10 +12,16 @@
 class BRMIPS : public BR {
 public:
     BRMIPS();
+    ~BRMIPS() override;
 
-    void predict(std::vector<Prediction>& prediction, Feature* features, Args& args) override;
+    void train(SRMatrix<Label>& labels, SRMatrix<Feature>& features, Args& args, std::string output) override;
+    void predict(std::vector<Prediction>& prediction, Feature* features, const PredictOptions& options) const override;
     void load(Args& args, std::string infile) override;
+    void saveIndex(Args& args, std::string infile) override;
 
 protected:
     MIPSIndex* mipsIndex;
+
+    // Loads weights and adds them as points of a new MIPS index without building it
+    void loadPoints(Args& args, std::string infile);
 };
\ No newline at end of file
@@ -23,6 +23,7 @@ MIPSIndex::MIPSIndex(int dim, bool sparse, Args& args) : dim(dim), sparse(sparse
     else spaceType = "negdotprod";
 
     space = SpaceFactoryRegistry<DATA_T>::Instance().CreateSpace(spaceType, empty);
+    index = nullptr;
 }
 
 MIPSIndex::~MIPSIndex() {
@@ -85,6 +86,21 @@ void MIPSIndex::createIndex(Args& args) {
     setEfSearch(args.hnswEfSearch);
 }
 
+void MIPSIndex::saveIndex(const std::string& outfile) {
+    std::cerr << "Saving MIPS index ...\n";
+    index->SaveIndex(outfile);
+}
+
+void MIPSIndex::loadIndex(Args& args, const std::string& infile) {
+    std::cerr << "Loading MIPS index ...\n";
+
+    // Graph is read from the file, points are taken from the data added before
+    index = MethodFactoryRegistry<DATA_T>::Instance().CreateMethod(false, methodType, spaceType, *space, data);
+    index->LoadIndex(infile);
+
+    setEfSearch(args.hnswEfSearch);
+}
+
 void MIPSIndex::setEfSearch(int ef){
     AnyParams QueryTimeParams({"efSearch=" + std::to_string(ef),});
 
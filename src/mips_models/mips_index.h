@@ -37,6 +37,11 @@ public:
     void addPoint(Weight* pointData, int size, int label);
     void addPoint(UnorderedMap<int, Weight>* pointData, int label);
     void createIndex(Args& args);
+    // Saved index can be loaded only after adding the same points in the same order
+    void saveIndex(const std::string& outfile);
+    void loadIndex(Args& args, const std::string& infile);
+    // Index depends on the space, so files of dense and sparse indices differ
+    inline std::string indexFileName() const { return "mips_index_" + spaceType + ".bin"; }
 
     void setEfSearch(int ef);
     std::priority_queue<Prediction> predict(Feature* data, int k);
@@ -10,6 +10,7 @@
 #include <list>
 #include <vector>
 
+#include "prediction_context.h"
 #include "set_utility.h"
 #include "ubop_mips.h"
 
@@ -19,14 +20,17 @@ UBOPMIPS::UBOPMIPS() {
     name = "UBOP MIPS";
 }
 
-void UBOPMIPS::predict(std::vector<Prediction>& prediction, Feature* features, Args& args) {
+void UBOPMIPS::predict(std::vector<Prediction>& prediction, Feature* features, const PredictOptions& options) const {
 
     int k;
-    if(args.ubopMipsK < 1) k = std::ceil(static_cast<double>(bases.size()) * args.ubopMipsK);
-    else k = args.ubopMipsK;
+    if(options.ubopMipsK < 1) k = std::ceil(static_cast<double>(bases.size()) * options.ubopMipsK);
+    else k = options.ubopMipsK;
 
-    std::vector<Prediction> allPredictions;
-    UnorderedSet<int> seenLabels;
+    PredictionContext& context = PredictionContext::local();
+    std::vector<Prediction>& allPredictions = context.predictions;
+    allPredictions.clear();
+    UnorderedSet<int>& seenLabels = context.seenLabels;
+    seenLabels.clear();
     std::priority_queue<Prediction> mipsPrediction = mipsIndex->predict(features, k);
     while (!mipsPrediction.empty()) {
         auto p = mipsPrediction.top();
@@ -37,7 +41,7 @@ void UBOPMIPS::predict(std::vector<Prediction>& prediction, Feature* features, A
     }
 
     // BOP part
-    std::shared_ptr<SetUtility> u = SetUtility::factory(args, outputSize());
+    SetUtility* u = &context.getSetUtility(options, outputSize());
     double P = 0, bestU = 0;
     for (int i = 0; i < allPredictions.size(); ++i) {
         auto& p = allPredictions[i];
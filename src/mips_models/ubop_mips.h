@@ -12,5 +12,5 @@ class UBOPMIPS : public BRMIPS {
 public:
     UBOPMIPS();
 
-    void predict(std::vector<Prediction>& prediction, Feature* features, Args& args) override;
+    void predict(std::vector<Prediction>& prediction, Feature* features, const PredictOptions& options) const override;
 };
\ No newline at end of file
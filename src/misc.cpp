@@ -35,28 +35,65 @@ std::vector<Prediction> computeLabelsPriors(const SRMatrix<Label>& labels) {
     return labelsProb;
 }
 
-void computeLabelsFeaturesMatrixThread(std::vector<std::vector<Feature>>& labelsFeatures,
-                                        std::vector<std::vector<int>>& labelsExamples,
-                                        const SRMatrix<Label>& labels, const SRMatrix<Feature>& features,
-                                        bool norm, bool weightedFeatures, int threadId, int threads){
-    int size = labelsExamples.size();
-    for (int l = threadId; l < size; l += threads) {
-        if (threadId == 0) printProgress(l, size);
-        UnorderedMap<int, double> lFeatures;
-
-        for (const auto& e : labelsExamples[l]){
-            Feature* f = (Feature*)features[e];
-            if(f->index == 1) ++f; // Skip bias feature
-            if(weightedFeatures) addVector(f, 1.0 / features.size(e), lFeatures);
-            else addVector(f, 1.0, lFeatures);
-        }
+std::vector<double> computeSquaredNorms(const SRMatrix<Feature>& features) {
+    std::cerr << "Computing squared norms of examples ...\n";
+
+    int rows = features.rows();
+    std::vector<double> norms(rows);
+    for (int r = 0; r < rows; ++r) norms[r] = squaredNorm(features[r]);
+
+    return norms;
+}
 
-        for(auto& f : lFeatures)
-            labelsFeatures[l].push_back({f.first, f.second});
+// Number of labels processed by a thread at once
+const int labelsBlockSize = 64;
 
-        std::sort(labelsFeatures[l].begin(), labelsFeatures[l].end());
-        if(norm) unitNorm(labelsFeatures[l]);
-        else divVector(labelsFeatures[l], labelsExamples[l].size());
+void computeLabelsFeaturesMatrixThread(std::vector<std::vector<Feature>>& labelsFeatures,
+                                       const std::vector<int>& labelsExamples,
+                                       const std::vector<size_t>& labelsExamplesStart,
+                                       const SRMatrix<Feature>& features, bool norm, bool weightedFeatures,
+                                       std::atomic<int>& nextBlock, int threadId){
+    int size = labelsFeatures.size();
+
+    // Dense accumulator of the row with the list of touched columns (Gustavson's algorithm),
+    // only the touched entries are cleared after each row
+    std::vector<double> acc(features.cols(), 0);
+    std::vector<bool> touched(features.cols(), false);
+    std::vector<int> touchedIndices;
+
+    // Blocks of labels are taken dynamically, so labels with many examples do not stall a single thread
+    for (int b = nextBlock++; b * labelsBlockSize < size; b = nextBlock++) {
+        int blockEnd = std::min((b + 1) * labelsBlockSize, size);
+        for (int l = b * labelsBlockSize; l < blockEnd; ++l) {
+            if (threadId == 0) printProgress(l, size);
+
+            for (size_t i = labelsExamplesStart[l]; i < labelsExamplesStart[l + 1]; ++i) {
+                int e = labelsExamples[i];
+                const Feature* f = features[e];
+                if (f->index == 1) ++f; // Skip bias feature
+                double scalar = weightedFeatures ? 1.0 / features.size(e) : 1.0;
+                for (; f->index != -1; ++f) {
+                    if (!touched[f->index]) {
+                        touched[f->index] = true;
+                        touchedIndices.push_back(f->index);
+                    }
+                    acc[f->index] += f->value * scalar;
+                }
+            }
+
+            std::sort(touchedIndices.begin(), touchedIndices.end());
+            auto& lFeatures = labelsFeatures[l];
+            lFeatures.reserve(touchedIndices.size());
+            for (const auto& i : touchedIndices) {
+                lFeatures.push_back({i, acc[i]});
+                acc[i] = 0;
+                touched[i] = false;
+            }
+            touchedIndices.clear();
+
+            if (norm) unitNorm(lFeatures);
+            else divVector(lFeatures, labelsExamplesStart[l + 1] - labelsExamplesStart[l]);
+        }
     }
 }
 
@@ -66,21 +103,80 @@ void computeLabelsFeaturesMatrix(SRMatrix<Feature>& labelsFeatures, const SRMatr
     assert(features.rows() == labels.rows());
     std::cerr << "Computing labels' features matrix in " << threads << " threads ...\n";
 
-    // Labels matrix transposed dot features matrix
-    std::vector<std::vector<int>> labelsExamples(labels.cols());
-    for(int i = 0; i < labels.rows(); ++i)
-        for(int j = 0; j < labels.size(i); ++j)
-            labelsExamples[labels[i][j]].push_back(i);
+    // Labels matrix transposed (CSR) dot features matrix
+    std::vector<size_t> labelsExamplesStart(labels.cols() + 1, 0);
+    for (int i = 0; i < labels.rows(); ++i)
+        for (int j = 0; j < labels.size(i); ++j) ++labelsExamplesStart[labels[i][j] + 1];
+    for (int l = 0; l < labels.cols(); ++l) labelsExamplesStart[l + 1] += labelsExamplesStart[l];
+
+    std::vector<int> labelsExamples(labelsExamplesStart.back());
+    std::vector<size_t> labelsExamplesPos(labelsExamplesStart.begin(), labelsExamplesStart.end() - 1);
+    for (int i = 0; i < labels.rows(); ++i)
+        for (int j = 0; j < labels.size(i); ++j) labelsExamples[labelsExamplesPos[labels[i][j]]++] = i;
 
     std::vector<std::vector<Feature>> tmpLabelsFeatures(labels.cols());
+    std::atomic<int> nextBlock(0);
     ThreadSet tSet;
     for (int t = 0; t < threads; ++t)
-        tSet.add(computeLabelsFeaturesMatrixThread, std::ref(tmpLabelsFeatures), std::ref(labelsExamples),
-                 std::ref(labels), std::ref(features), norm, weightedFeatures, t, threads);
+        tSet.add(computeLabelsFeaturesMatrixThread, std::ref(tmpLabelsFeatures), std::cref(labelsExamples),
+                 std::cref(labelsExamplesStart), std::cref(features), norm, weightedFeatures, std::ref(nextBlock), t);
     tSet.joinAll();
 
-    for(auto& v : tmpLabelsFeatures)
+    for (auto& v : tmpLabelsFeatures) {
         labelsFeatures.appendRow(v);
+        std::vector<Feature>().swap(v);
+    }
+}
+
+// Number of output dimensions each input feature is projected to
+const int projectionNonZeros = 4;
+
+// SplitMix64 finalizer, used to generate the projection matrix on the fly
+inline uint64_t mixHash(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+void computeRandomProjectionThread(std::vector<std::vector<Feature>>& projected, const SRMatrix<Feature>& matrix,
+                                   int dims, uint64_t seed, bool norm, int threadId, int threads) {
+    const double scale = 1.0 / std::sqrt(projectionNonZeros);
+    std::vector<double> dense(dims);
+    int rows = matrix.rows();
+    for (int r = threadId; r < rows; r += threads) {
+        if (threadId == 0) printProgress(r, rows);
+        std::fill(dense.begin(), dense.end(), 0);
+
+        // Each feature is mapped to projectionNonZeros dimensions with random signs
+        for (const Feature* f = matrix[r]; f->index != -1; ++f) {
+            for (int i = 0; i < projectionNonZeros; ++i) {
+                uint64_t h = mixHash(seed + static_cast<uint64_t>(f->index) * projectionNonZeros + i);
+                dense[h % dims] += (h >> 63 ? scale : -scale) * f->value;
+            }
+        }
+
+        projected[r].resize(dims);
+        for (int i = 0; i < dims; ++i) projected[r][i] = {i, dense[i]};
+        if (norm) unitNorm(projected[r]);
+    }
+}
+
+void computeRandomProjection(SRMatrix<Feature>& projected, const SRMatrix<Feature>& matrix, int dims, int seed,
+                             int threads, bool norm) {
+    std::cerr << "Projecting " << matrix.rows() << " rows to " << dims << " dimensions in " << threads
+              << " threads ...\n";
+
+    std::vector<std::vector<Feature>> tmpProjected(matrix.rows());
+    ThreadSet tSet;
+    for (int t = 0; t < threads; ++t)
+        tSet.add(computeRandomProjectionThread, std::ref(tmpProjected), std::cref(matrix), dims,
+                 mixHash(static_cast<uint64_t>(seed)), norm, t, threads);
+    tSet.joinAll();
+
+    for (auto& v : tmpProjected) {
+        projected.appendRow(v);
+        std::vector<Feature>().swap(v);
+    }
 }
 
 // Splits string
@@ -133,6 +229,22 @@ void FileHelper::loadFromFile(std::string infile) {
     in.close();
 }
 
+// TODO: refactor this as load/save vector
+std::vector<double> loadThresholds(std::string infile){
+    std::vector<double> thresholds;
+    std::ifstream thresholdsIn(infile);
+    double t;
+    while (thresholdsIn >> t) thresholds.push_back(t);
+    return thresholds;
+}
+
+void saveThresholds(std::vector<double>& thresholds, std::string outfile){
+    std::ofstream out(outfile);
+    for(auto t : thresholds)
+        out << t << std::endl;
+    out.close();
+}
+
 // Joins two paths
 std::string joinPath(const std::string& path1, const std::string& path2) {
     char sep = '/';
@@ -6,6 +6,7 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <cstdint>
 #include <iostream>
@@ -19,15 +20,25 @@
 // Data utils
 std::vector<Prediction> computeLabelsPriors(const SRMatrix<Label>& labels);
 
+std::vector<double> computeSquaredNorms(const SRMatrix<Feature>& features);
+
 void computeLabelsFeaturesMatrixThread(std::vector<std::vector<Feature>>& labelsFeatures,
-                                       std::vector<std::vector<int>>& labelsExamples,
-                                       const SRMatrix<Label>& labels, const SRMatrix<Feature>& features,
-                                       bool norm, bool weightedFeatures, int threadId, int threads);
+                                       const std::vector<int>& labelsExamples,
+                                       const std::vector<size_t>& labelsExamplesStart,
+                                       const SRMatrix<Feature>& features, bool norm, bool weightedFeatures,
+                                       std::atomic<int>& nextBlock, int threadId);
 
 void computeLabelsFeaturesMatrix(SRMatrix<Feature>& labelsFeatures, const SRMatrix<Label>& labels,
                                  const SRMatrix<Feature>& features, int threads = 1, bool norm = false,
                                  bool weightedFeatures = false);
 
+void computeRandomProjectionThread(std::vector<std::vector<Feature>>& projected, const SRMatrix<Feature>& matrix,
+                                   int dims, uint64_t seed, bool norm, int threadId, int threads);
+
+// Projects rows of the sparse matrix to dense rows of given dimension using sparse random projection
+void computeRandomProjection(SRMatrix<Feature>& projected, const SRMatrix<Feature>& matrix, int dims, int seed,
+                             int threads = 1, bool norm = false);
+
 // Math utils
 template <typename T, typename U> inline T argMax(const std::unordered_map<T, U>& map) {
     auto pMax = std::max_element(map.begin(), map.end(), [](const std::pair<T, U>& p1, const std::pair<T, U>& p2) {
@@ -177,7 +188,7 @@ template <typename T> inline void mulVector(T& vector, double scalar) {
 
 // Divide vector by scalar
 inline void divVector(Feature* vector, double scalar, const size_t size) {
-    for (Feature* f = vector; f->index != -1; ++f) f->value /= scalar;
+    for (int f = 0; f < size; ++f) vector[f].value /= scalar;
 }
 
 inline void divVector(Feature* vector, double scalar) {
@@ -210,6 +221,12 @@ inline void unitNorm(Feature* data, const size_t size) {
 
 template <typename T> inline void unitNorm(T& vector) { unitNorm(vector.data(), vector.size()); }
 
+inline double squaredNorm(const Feature* vector) {
+    double norm = 0;
+    for (const Feature* f = vector; f->index != -1; ++f) norm += f->value * f->value;
+    return norm;
+}
+
 inline void threshold(std::vector<Feature>& vector, double threshold) {
     int c = 0;
     for (int i = 0; i < vector.size(); ++i)
@@ -244,6 +261,11 @@ inline void printProgress(int state, int max) {
     if (max > 100 && state % (max / 100) == 0) std::cerr << "  " << state / (max / 100) << "%\r";
 }
 
+// Print progress of work shared by threads, state advanced from prevState to state
+inline void printProgress(int prevState, int state, int max) {
+    if (max > 100 && state / (max / 100) != prevState / (max / 100)) std::cerr << "  " << state / (max / 100) << "%\r";
+}
+
 // Print vector
 template <typename T> void printVector(std::vector<T> vec) {
     for (size_t i = 0; i < vec.size(); ++i) {
@@ -286,6 +308,10 @@ inline void loadVar(std::istream& in, std::string& var) {
     in.read((char*)&var[0], size);
 }
 
+// Loads and saves thresholds, one per line
+std::vector<double> loadThresholds(std::string infile);
+void saveThresholds(std::vector<double>& thresholds, std::string outfile);
+
 // Joins two paths
 std::string joinPath(const std::string& path1, const std::string& path2);
 
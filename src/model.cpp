@@ -3,12 +3,14 @@
  * All rights reserved.
  */
 
+#include <chrono>
 #include <fstream>
 #include <iomanip>
 #include <mutex>
 #include <string>
 
 #include "ensemble.h"
+#include "linear.h"
 #include "measure.h"
 #include "model.h"
 #include "threads.h"
@@ -33,6 +35,8 @@ std::shared_ptr<Model> Model::factory(Args& args) {
     std::shared_ptr<Model> model = nullptr;
 
     if (args.ensemble > 0) {
+        if (args.ensemble > maxEnsembleSize)
+            throw std::invalid_argument("Ensemble can have at most " + std::to_string(maxEnsembleSize) + " members");
         switch (args.modelType) {
         case hsm: model = std::static_pointer_cast<Model>(std::make_shared<Ensemble<HSM>>()); break;
         case plt: model = std::static_pointer_cast<Model>(std::make_shared<Ensemble<BatchPLT>>()); break;
@@ -64,36 +68,106 @@ Model::Model() {}
 
 Model::~Model() {}
 
-void Model::predictWithThresholds(std::vector<Prediction>& prediction, Feature* features, Args& args) {
+void Model::predictForLabels(std::vector<double>& values, const std::vector<Label>& labels, Feature* features,
+                             const PredictOptions& options) const {
+    values.resize(labels.size());
+    for (size_t i = 0; i < labels.size(); ++i) values[i] = predictForLabel(labels[i], features, options);
+}
+
+void Model::saveIndex(Args& args, std::string infile) {
+    throw std::invalid_argument(name + " model does not use an index that can be saved");
+}
+
+void Model::printInfo() {
+    metrics.print(std::cout);
+}
+
+void Model::saveMetrics(std::string outfile) {
+    std::ofstream out(outfile);
+    metrics.saveJson(out);
+    out.close();
+}
+
+void Model::predictWithThresholds(std::vector<Prediction>& prediction, Feature* features,
+                                  const PredictOptions& options) const {
     std::vector<Prediction> tmpPrediction;
-    predict(tmpPrediction, features, args);
+    predict(tmpPrediction, features, options);
     for (auto& p : tmpPrediction)
         if (p.value >= thresholds[p.label]) prediction.push_back(p);
 }
 
-void Model::predictBatchThread(int threadId, Model* model, std::vector<std::vector<Prediction>>& predictions,
-                               SRMatrix<Feature>& features, Args& args, const int startRow, const int stopRow) {
-    const int batchSize = stopRow - startRow;
-    for (int r = startRow; r < stopRow; ++r) {
-        int i = r - startRow;
-        model->predict(predictions[r], features[r], args);
-        if (!threadId) printProgress(i, batchSize);
+// Rows are claimed by the threads in chunks of this size
+const int predictionChunkSize = 16;
+
+// Set in the threads while they run tasks of the pool, waiting for the pool in them could deadlock
+static thread_local bool inThreadPool = false;
+
+// Marks the calling thread as running a task of the pool for its lifetime
+struct ThreadPoolTask {
+    bool wasInThreadPool;
+    ThreadPoolTask() : wasInThreadPool(inThreadPool) { inThreadPool = true; }
+    ~ThreadPoolTask() { inThreadPool = wasInThreadPool; }
+};
+
+ThreadPool& Model::getThreadPool(int threads) {
+    static ThreadPool tPool(0);
+    static std::mutex tPoolMutex;
+
+    std::lock_guard<std::mutex> lock(tPoolMutex);
+    if (tPool.size() < static_cast<size_t>(threads)) tPool.grow(threads);
+    return tPool;
+}
+
+void Model::processChunksThread(int rows, int chunkSize, const std::function<void(int start, int stop)>& processChunk,
+                                std::atomic<int>& nextRow, std::atomic<int>& doneRows) {
+    ThreadPoolTask task;
+    for (int start = nextRow.fetch_add(chunkSize); start < rows; start = nextRow.fetch_add(chunkSize)) {
+        int stop = std::min(start + chunkSize, rows);
+        processChunk(start, stop);
+        int done = doneRows.fetch_add(stop - start);
+        printProgress(done, done + stop - start, rows);
+    }
+}
+
+void Model::processRowsInChunks(int rows, int chunkSize, int threads,
+                                const std::function<void(int start, int stop)>& processChunk) {
+    std::atomic<int> nextRow(0);
+    std::atomic<int> doneRows(0);
+
+    int tasks = std::min(threads, (rows + chunkSize - 1) / chunkSize);
+    if (tasks <= 1 || inThreadPool) {
+        processChunksThread(rows, chunkSize, processChunk, nextRow, doneRows);
+        return;
     }
+
+    ThreadPool& tPool = getThreadPool(threads);
+    std::vector<std::future<void>> results;
+    for (int t = 0; t < tasks; ++t)
+        results.emplace_back(tPool.enqueue(processChunksThread, rows, chunkSize, std::cref(processChunk),
+                                            std::ref(nextRow), std::ref(doneRows)));
+    for (auto& r : results) r.get();
 }
 
-std::vector<std::vector<Prediction>> Model::predictBatch(SRMatrix<Feature>& features, Args& args) {
-    std::cerr << "Starting prediction in " << args.threads << " threads ...\n";
+void Model::predictRows(std::vector<Prediction>* predictions, Feature* const* rows, int size,
+                        const PredictOptions& options) const {
+    for (int i = 0; i < size; ++i) predict(predictions[i], rows[i], options);
+}
+
+std::vector<std::vector<Prediction>> Model::predictBatch(SRMatrix<Feature>& features,
+                                                         const PredictOptions& options) const {
+    std::cerr << "Starting prediction in " << options.threads << " threads ...\n";
 
     int rows = features.rows();
     std::vector<std::vector<Prediction>> predictions(rows);
-
-    // Run prediction in parallel using thread set
-    ThreadSet tSet;
-    int tRows = ceil(static_cast<double>(rows) / args.threads);
-    for (int t = 0; t < args.threads; ++t)
-        tSet.add(predictBatchThread, t, this, std::ref(predictions), std::ref(features), std::ref(args), t * tRows,
-                 std::min((t + 1) * tRows, rows));
-    tSet.joinAll();
+    processRowsInChunks(rows, predictionChunkSize, options.threads, [&](int start, int stop) {
+        MetricsCounters& counters = metrics.local();
+        for (int r = start; r < stop; ++r) {
+            auto startTime = std::chrono::steady_clock::now();
+            predict(predictions[r], features[r], options);
+            counters.latency.add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - startTime).count());
+        }
+    });
 
     return predictions;
 }
@@ -107,29 +181,21 @@ void Model::updateThresholds(UnorderedMap<int, double> thToUpdate){
         thresholds[th.first] = th.second;
 }
 
-void Model::predictBatchWithThresholdsThread(int threadId, Model* model, std::vector<std::vector<Prediction>>& predictions,
-                                             SRMatrix<Feature>& features, Args& args, const int startRow, const int stopRow) {
-    const int batchSize = stopRow - startRow;
-    for (int r = startRow; r < stopRow; ++r) {
-        int i = r - startRow;
-        model->predictWithThresholds(predictions[r], features[r], args);
-        if (!threadId) printProgress(i, batchSize);
-    }
-}
-
-std::vector<std::vector<Prediction>> Model::predictBatchWithThresholds(SRMatrix<Feature>& features, Args& args) {
-    std::cerr << "Starting prediction in " << args.threads << " threads ...\n";
+std::vector<std::vector<Prediction>> Model::predictBatchWithThresholds(SRMatrix<Feature>& features,
+                                                                       const PredictOptions& options) const {
+    std::cerr << "Starting prediction in " << options.threads << " threads ...\n";
 
     int rows = features.rows();
     std::vector<std::vector<Prediction>> predictions(rows);
-
-    // Run prediction in parallel using thread set
-    ThreadSet tSet;
-    int tRows = ceil(static_cast<double>(rows) / args.threads);
-    for (int t = 0; t < args.threads; ++t)
-        tSet.add(predictBatchWithThresholdsThread, t, this, std::ref(predictions), std::ref(features),
-                 std::ref(args), t * tRows, std::min((t + 1) * tRows, rows));
-    tSet.joinAll();
+    processRowsInChunks(rows, predictionChunkSize, options.threads, [&](int start, int stop) {
+        MetricsCounters& counters = metrics.local();
+        for (int r = start; r < stop; ++r) {
+            auto startTime = std::chrono::steady_clock::now();
+            predictWithThresholds(predictions[r], features[r], options);
+            counters.latency.add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - startTime).count());
+        }
+    });
 
     return predictions;
 }
@@ -140,6 +206,7 @@ double Model::microOfo(SRMatrix<Feature>& features, SRMatrix<Label>& labels, Arg
 
     std::cerr << "Optimizing Micro F measure for " << args.epochs << " epochs using " << args.threads << " threads ...\n";
 
+    PredictOptions options(args);
     const int examples = features.rows() * args.epochs;
     for (int i = 0; i < examples; ++i) {
         printProgress(i, examples);
@@ -147,8 +214,8 @@ double Model::microOfo(SRMatrix<Feature>& features, SRMatrix<Label>& labels, Arg
 
         // Predict with current thresholds
         std::vector<Prediction> prediction;
-        args.threshold = a / b;
-        predict(prediction, features[r], args);
+        options.threshold = a / b;
+        predict(prediction, features[r], options);
 
         // Update a and b counters
         for (const auto &p : prediction) {
@@ -177,22 +244,27 @@ std::vector<double> Model::macroOfo(SRMatrix<Feature>& features, SRMatrix<Label>
     // Set initial thresholds
     setThresholds(thresholds);
 
-    ThreadSet tSet;
+    // Each thread goes over its range of rows, the order of updates within the range matters
+    PredictOptions options(args);
+    ThreadPool& tPool = getThreadPool(args.threads);
+    std::vector<std::future<void>> results;
     int tRows = ceil(static_cast<double>(features.rows()) / args.threads);
     for (int t = 0; t < args.threads; ++t)
-        tSet.add(ofoThread, t, this, std::ref(as), std::ref(bs), std::ref(features), std::ref(labels),
-                 std::ref(args),
-                 t * tRows, std::min((t + 1) * tRows, features.rows()));
-    tSet.joinAll();
+        results.emplace_back(tPool.enqueue(ofoThread, t, this, std::ref(as), std::ref(bs), std::ref(features),
+                                           std::ref(labels), std::cref(options), args.epochs, t * tRows,
+                                           std::min((t + 1) * tRows, features.rows())));
+    for (auto& r : results) r.get();
 
     return thresholds;
 }
 
 void Model::ofoThread(int threadId, Model* model, std::vector<double>& as, std::vector<double>& bs,
-                      SRMatrix<Feature>& features, SRMatrix<Label>& labels, Args& args, const int startRow, const int stopRow) {
+                      SRMatrix<Feature>& features, SRMatrix<Label>& labels, const PredictOptions& options,
+                      int epochs, const int startRow, const int stopRow) {
+    ThreadPoolTask task;
 
     const int rowsRange = stopRow - startRow;
-    const int examples = rowsRange * args.epochs;
+    const int examples = rowsRange * epochs;
 
     for (int i = 0; i < examples; ++i) {
         if (!threadId) printProgress(i, examples);
@@ -200,7 +272,7 @@ void Model::ofoThread(int threadId, Model* model, std::vector<double>& as, std::
 
         // Predict with current thresholds
         std::vector<Prediction> prediction;
-        model->predictWithThresholds(prediction, features[r], args);
+        model->predictWithThresholds(prediction, features[r], options);
 
         // Update a and b counters
         for (const auto& p : prediction) {
@@ -258,20 +330,22 @@ std::vector<double> Model::ofo(SRMatrix<Feature>& features, SRMatrix<Label>& lab
 }
 
 Base* Model::trainBase(int n, int r, std::vector<double>& baseLabels, std::vector<Feature*>& baseFeatures,
-                       std::vector<double>* instancesWeights, Args& args) {
+                       std::vector<double>* instancesWeights, std::vector<double>* instancesNorms, Args& args) {
     Base* base = new Base();
-    base->train(n, r, baseLabels, baseFeatures, instancesWeights, args);
+    base->train(n, r, baseLabels, baseFeatures, instancesWeights, instancesNorms, nullptr, args);
     return base;
 }
 
 void Model::trainBatchThread(int n, int r, std::vector<std::promise<Base *>>& results, std::vector<std::vector<double>>& baseLabels,
                              std::vector<std::vector<Feature*>>& baseFeatures,
-                             std::vector<std::vector<double>*>* instancesWeights, Args& args, int threadId, int threads) {
+                             std::vector<std::vector<double>*>* instancesWeights,
+                             std::vector<std::vector<double>>* instancesNorms, Args& args, int threadId, int threads) {
 
     size_t size = baseLabels.size();
     for (int i = threadId; i < size; i += threads)
         results[i].set_value(trainBase(n, r, baseLabels[i], baseFeatures[i],
-                                   (instancesWeights != nullptr) ? (*instancesWeights)[i] : nullptr, args));
+                                   (instancesWeights != nullptr) ? (*instancesWeights)[i] : nullptr,
+                                   (instancesNorms != nullptr) ? &(*instancesNorms)[i] : nullptr, args));
 }
 
 void Model::saveResults(std::ofstream& out, std::vector<std::future<Base*>>& results) {
@@ -285,21 +359,24 @@ void Model::saveResults(std::ofstream& out, std::vector<std::future<Base*>>& res
 
 void Model::trainBases(std::string outfile, int n, std::vector<std::vector<double>>& baseLabels,
                        std::vector<std::vector<Feature*>>& baseFeatures,
-                       std::vector<std::vector<double>*>* instancesWeights, Args& args) {
+                       std::vector<std::vector<double>*>* instancesWeights,
+                       std::vector<std::vector<double>>* instancesNorms, Args& args) {
 
     std::ofstream out(outfile);
     int size = baseLabels.size();
     out.write((char*)&size, sizeof(size));
-    trainBases(out, n, baseLabels, baseFeatures, instancesWeights, args);
+    trainBases(out, n, baseLabels, baseFeatures, instancesWeights, instancesNorms, args);
     out.close();
 }
 
 void Model::trainBases(std::ofstream& out, int n, std::vector<std::vector<double>>& baseLabels,
                        std::vector<std::vector<Feature*>>& baseFeatures,
-                       std::vector<std::vector<double>*>* instancesWeights, Args& args) {
+                       std::vector<std::vector<double>*>* instancesWeights,
+                       std::vector<std::vector<double>>* instancesNorms, Args& args) {
 
     assert(baseLabels.size() == baseFeatures.size());
     if (instancesWeights != nullptr) assert(baseLabels.size() == instancesWeights->size());
+    if (instancesNorms != nullptr) assert(baseLabels.size() == instancesNorms->size());
 
     size_t size = baseLabels.size(); // This "batch" size
     std::cerr << "Starting training " << size << " base estimators in " << args.threads << " threads ...\n";
@@ -313,7 +390,7 @@ void Model::trainBases(std::ofstream& out, int n, std::vector<std::vector<double
         std::vector<std::future<Base *>> results(size);
         for(int i = 0; i < size; ++i) results[i] = resultsPromise[i].get_future();
         for (int t = 0; t < args.threads; ++t)
-            tSet.add(trainBatchThread, n, baseFeatures[0].size(), std::ref(resultsPromise), std::ref(baseLabels), std::ref(baseFeatures), instancesWeights, args, t, args.threads);
+            tSet.add(trainBatchThread, n, baseFeatures[0].size(), std::ref(resultsPromise), std::ref(baseLabels), std::ref(baseFeatures), instancesWeights, instancesNorms, args, t, args.threads);
 
         // Thread pool solution is slower
         /*
@@ -322,7 +399,8 @@ void Model::trainBases(std::ofstream& out, int n, std::vector<std::vector<double
         results.reserve(size);
         for (int i = 0; i < size; ++i)
             results.emplace_back(tPool.enqueue(trainBase, n, std::ref(baseLabels[i]), std::ref(baseFeatures[i]),
-                                               (instancesWeights != nullptr) ? (*instancesWeights)[i] : nullptr, args));
+                                               (instancesWeights != nullptr) ? (*instancesWeights)[i] : nullptr,
+                                               (instancesNorms != nullptr) ? &(*instancesNorms)[i] : nullptr, args));
         */
 
         // Saving in the main thread
@@ -331,37 +409,107 @@ void Model::trainBases(std::ofstream& out, int n, std::vector<std::vector<double
     } else {
         for (int i = 0; i < size; ++i){
             Base* base = new Base();
-            base->train(n, baseFeatures[0].size(), baseLabels[i], baseFeatures[i], (instancesWeights != nullptr) ? (*instancesWeights)[i] : nullptr, args);
+            base->train(n, baseFeatures[0].size(), baseLabels[i], baseFeatures[i], (instancesWeights != nullptr) ? (*instancesWeights)[i] : nullptr,
+                        (instancesNorms != nullptr) ? &(*instancesNorms)[i] : nullptr, nullptr, args);
+            base->save(out);
+            delete base;
+        }
+    }
+}
+
+void Model::trainBases(const std::vector<std::string>& outfiles, const std::vector<int>& sizes, int n,
+                       std::vector<std::vector<double>>& baseLabels, std::vector<std::vector<Feature*>>& baseFeatures,
+                       std::vector<std::vector<double>*>* instancesWeights,
+                       std::vector<std::vector<double>>* instancesNorms, Args& args) {
+
+    assert(outfiles.size() == sizes.size());
+    assert(baseLabels.size() == baseFeatures.size());
+
+    int size = baseLabels.size();
+    std::cerr << "Starting training " << size << " base estimators of " << outfiles.size() << " models in "
+              << args.threads << " threads ...\n";
+
+    // Threads take bases of all the models in turn, the main thread saves them to the models' files
+    ThreadSet tSet;
+    std::vector<std::promise<Base *>> resultsPromise(size);
+    std::vector<std::future<Base *>> results(size);
+    for(int i = 0; i < size; ++i) results[i] = resultsPromise[i].get_future();
+    if(args.threads > 1) {
+        for (int t = 0; t < args.threads; ++t)
+            tSet.add(trainBatchThread, n, baseFeatures[0].size(), std::ref(resultsPromise), std::ref(baseLabels),
+                     std::ref(baseFeatures), instancesWeights, instancesNorms, args, t, args.threads);
+    }
+
+    int first = 0;
+    for (int m = 0; m < outfiles.size(); ++m) {
+        std::ofstream out(outfiles[m]);
+        out.write((char*)&sizes[m], sizeof(sizes[m]));
+        for (int i = first; i < first + sizes[m]; ++i) {
+            printProgress(i, size);
+            Base* base;
+            if(args.threads > 1) base = results[i].get();
+            else base = trainBase(n, baseFeatures[0].size(), baseLabels[i], baseFeatures[i],
+                                  (instancesWeights != nullptr) ? (*instancesWeights)[i] : nullptr,
+                                  (instancesNorms != nullptr) ? &(*instancesNorms)[i] : nullptr, args);
             base->save(out);
             delete base;
         }
+        out.close();
+        first += sizes[m];
     }
+    tSet.joinAll();
 }
 
 void Model::trainBatchWithSameFeaturesThread(int n, std::vector<std::promise<Base *>>& results,
                                              std::vector<std::vector<double>>& baseLabels,
                                              std::vector<Feature*>& baseFeatures,
-                                             std::vector<double>* instancesWeights, Args& args, int threadId, int threads){
-    size_t size = baseLabels.size();
-    for(int i = threadId; i < size; i += threads)
-        results[i].set_value(trainBase(n, 0, baseLabels[i], baseFeatures, instancesWeights, args));
+                                             std::vector<double>* instancesWeights, std::vector<double>* instancesNorms,
+                                             Feature** instancesColumns, Args& args, int threadId, int threads){
+    int size = baseLabels.size();
+    int block = std::max(1, args.labelsBlock);
+    for (int b = threadId * block; b < size; b += threads * block) {
+        std::vector<Base*> bases;
+        std::vector<std::vector<double>*> labels;
+        for (int i = b; i < std::min(b + block, size); ++i) {
+            bases.push_back(new Base());
+            labels.push_back(&baseLabels[i]);
+        }
+
+        Base::trainBlock(n, 0, bases, labels, baseFeatures, instancesWeights, instancesNorms, instancesColumns, args);
+        for (int i = 0; i < bases.size(); ++i) results[b + i].set_value(bases[i]);
+    }
 }
 
 void Model::trainBasesWithSameFeatures(std::string outfile, int n, std::vector<std::vector<double>>& baseLabels,
                                        std::vector<Feature*>& baseFeatures,
-                                       std::vector<double>* instancesWeights, Args& args) {
+                                       std::vector<double>* instancesWeights, std::vector<double>* instancesNorms,
+                                       Args& args) {
     std::ofstream out(outfile);
     int size = baseLabels.size();
     out.write((char*)&size, sizeof(size));
-    trainBasesWithSameFeatures(out, n, baseLabels, baseFeatures, instancesWeights, args);
+    trainBasesWithSameFeatures(out, n, baseLabels, baseFeatures, instancesWeights, instancesNorms, args);
     out.close();
 }
 
 void Model::trainBasesWithSameFeatures(std::ofstream& out, int n, std::vector<std::vector<double>>& baseLabels,
                                        std::vector<Feature*>& baseFeatures,
-                                       std::vector<double>* instancesWeights, Args& args) {
+                                       std::vector<double>* instancesWeights, std::vector<double>* instancesNorms,
+                                       Args& args) {
 
     int size = baseLabels.size(); // This "batch" size
+
+    // L1 solvers work on columns of features, transpose them once for all bases
+    Feature** instancesColumns = nullptr;
+    Feature* columnsSpace = nullptr;
+    if (args.optimizerType == liblinear && (args.solverType == L1R_LR || args.solverType == L1R_L2LOSS_SVC)) {
+        std::cerr << "Transposing features for L1 solvers ...\n";
+        problem P{};
+        P.l = static_cast<int>(baseFeatures.size());
+        P.n = n;
+        P.x = baseFeatures.data();
+        transpose_instances(&P, &instancesColumns, &columnsSpace);
+    }
+
     std::cerr << "Starting training " << size << " base estimators in " << args.threads << " threads ...\n";
 
     // Run learning in parallel
@@ -372,7 +520,7 @@ void Model::trainBasesWithSameFeatures(std::ofstream& out, int n, std::vector<st
         std::vector<std::future<Base *>> results(size);
         for(int i = 0; i < size; ++i) results[i] = resultsPromise[i].get_future();
         for (int t = 0; t < args.threads; ++t)
-            tSet.add(trainBatchWithSameFeaturesThread, n, std::ref(resultsPromise), std::ref(baseLabels), std::ref(baseFeatures), instancesWeights, args, t, args.threads);
+            tSet.add(trainBatchWithSameFeaturesThread, n, std::ref(resultsPromise), std::ref(baseLabels), std::ref(baseFeatures), instancesWeights, instancesNorms, instancesColumns, args, t, args.threads);
 
         // Thread pool solution is slower
         /*
@@ -381,20 +529,33 @@ void Model::trainBasesWithSameFeatures(std::ofstream& out, int n, std::vector<st
         results.reserve(size);
 
         for (int i = 0; i < size; ++i)
-            results.emplace_back(tPool.enqueue(trainBase, n, std::ref(baseLabels[i]), std::ref(baseFeatures), instancesWeights, args));
+            results.emplace_back(tPool.enqueue(trainBase, n, std::ref(baseLabels[i]), std::ref(baseFeatures), instancesWeights, instancesNorms, args));
         */
 
         // Saving in the main thread
         saveResults(out, results);
         tSet.joinAll();
     } else {
-        for (int i = 0; i < size; ++i){
-            Base* base = new Base();
-            base->train(n, 0, baseLabels[i], baseFeatures, instancesWeights, args);
-            base->save(out);
-            delete base;
+        int block = std::max(1, args.labelsBlock);
+        for (int b = 0; b < size; b += block) {
+            std::vector<Base*> bases;
+            std::vector<std::vector<double>*> labels;
+            for (int i = b; i < std::min(b + block, size); ++i) {
+                bases.push_back(new Base());
+                labels.push_back(&baseLabels[i]);
+            }
+
+            Base::trainBlock(n, 0, bases, labels, baseFeatures, instancesWeights, instancesNorms, instancesColumns,
+                             args);
+            for (auto base : bases) {
+                base->save(out);
+                delete base;
+            }
         }
     }
+
+    delete[] instancesColumns;
+    delete[] columnsSpace;
 }
 
 std::vector<Base*> Model::loadBases(std::string infile) {
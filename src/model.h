@@ -5,14 +5,20 @@
 
 #pragma once
 
+#include <atomic>
 #include <fstream>
+#include <functional>
 #include <future>
+#include <memory>
 #include <string>
 
 #include "args.h"
 #include "base.h"
+#include "metrics.h"
 #include "types.h"
 
+class ThreadPool;
+
 class Model {
 public:
     static std::shared_ptr<Model> factory(Args& args);
@@ -21,74 +27,111 @@ public:
     virtual ~Model();
 
     virtual void train(SRMatrix<Label>& labels, SRMatrix<Feature>& features, Args& args, std::string output) = 0;
-    virtual void predict(std::vector<Prediction>& prediction, Feature* features, Args& args) = 0;
-    virtual double predictForLabel(Label label, Feature* features, Args& args) = 0;
-    virtual std::vector<std::vector<Prediction>> predictBatch(SRMatrix<Feature>& features, Args& args);
+    // Prediction does not modify the model, so it can be called by many threads with different options
+    virtual void predict(std::vector<Prediction>& prediction, Feature* features,
+                         const PredictOptions& options) const = 0;
+    virtual double predictForLabel(Label label, Feature* features, const PredictOptions& options) const = 0;
+    virtual void predictForLabels(std::vector<double>& values, const std::vector<Label>& labels, Feature* features,
+                                  const PredictOptions& options) const;
+    virtual std::vector<std::vector<Prediction>> predictBatch(SRMatrix<Feature>& features,
+                                                              const PredictOptions& options) const;
+    // Predicts the block of rows in the calling thread, predictions[i] is filled for rows[i]
+    virtual void predictRows(std::vector<Prediction>* predictions, Feature* const* rows, int size,
+                             const PredictOptions& options) const;
 
     // Prediction with thresholds and ofo
     virtual void setThresholds(std::vector<double> th);
     virtual void updateThresholds(UnorderedMap<int, double> thToUpdate);
-    virtual void predictWithThresholds(std::vector<Prediction>& prediction, Feature* features, Args& args);
-    virtual std::vector<std::vector<Prediction>> predictBatchWithThresholds(SRMatrix<Feature>& features, Args& args);
+    virtual void predictWithThresholds(std::vector<Prediction>& prediction, Feature* features,
+                                       const PredictOptions& options) const;
+    virtual std::vector<std::vector<Prediction>> predictBatchWithThresholds(SRMatrix<Feature>& features,
+                                                                            const PredictOptions& options) const;
     std::vector<double> ofo(SRMatrix<Feature>& features, SRMatrix<Label>& labels, Args& args);
     double microOfo(SRMatrix<Feature>& features, SRMatrix<Label>& labels, Args& args);
     std::vector<double> macroOfo(SRMatrix<Feature>& features, SRMatrix<Label>& labels, Args& args);
 
     virtual void load(Args& args, std::string infile) = 0;
+    // Builds the index used for prediction from the model saved in the directory and saves it there,
+    // so the index is not built every time the model is loaded
+    virtual void saveIndex(Args& args, std::string infile);
 
-    virtual void printInfo() {}
-    inline int outputSize() { return m; };
+    // Prints model's statistics and prediction metrics
+    virtual void printInfo();
+    void saveMetrics(std::string outfile);
+    inline int outputSize() const { return m; };
 
 protected:
     ModelType type;
     std::string name;
     int m; // Output size/number of labels
     std::vector<double> thresholds; // For prediction with thresholds
+    mutable Metrics metrics; // Counters and histograms of training and prediction, updated by many threads
 
     // Base utils
     static Base* trainBase(int n, int r, std::vector<double>& baseLabels, std::vector<Feature*>& baseFeatures,
-                           std::vector<double>* instancesWeights, Args& args);
+                           std::vector<double>* instancesWeights, std::vector<double>* instancesNorms, Args& args);
 
     static void trainBatchThread(int n, int r, std::vector<std::promise<Base *>>& results,
                                  std::vector<std::vector<double>>& baseLabels,
                                  std::vector<std::vector<Feature*>>& baseFeatures,
                                  std::vector<std::vector<double>*>* instancesWeights,
+                                 std::vector<std::vector<double>>* instancesNorms,
                                  Args& args, int threadId, int threads);
 
     static void trainBases(std::string outfile, int n, std::vector<std::vector<double>>& baseLabels,
                            std::vector<std::vector<Feature*>>& baseFeatures,
-                           std::vector<std::vector<double>*>* instancesWeights, Args& args);
+                           std::vector<std::vector<double>*>* instancesWeights,
+                           std::vector<std::vector<double>>* instancesNorms, Args& args);
 
     static void trainBases(std::ofstream& out, int n, std::vector<std::vector<double>>& baseLabels,
                            std::vector<std::vector<Feature*>>& baseFeatures,
-                           std::vector<std::vector<double>*>* instancesWeights, Args& args);
+                           std::vector<std::vector<double>*>* instancesWeights,
+                           std::vector<std::vector<double>>* instancesNorms, Args& args);
+
+    // Trains bases of several models in one schedule, bases of each model are saved to its own file
+    static void trainBases(const std::vector<std::string>& outfiles, const std::vector<int>& sizes, int n,
+                           std::vector<std::vector<double>>& baseLabels,
+                           std::vector<std::vector<Feature*>>& baseFeatures,
+                           std::vector<std::vector<double>*>* instancesWeights,
+                           std::vector<std::vector<double>>* instancesNorms, Args& args);
 
     static void trainBatchWithSameFeaturesThread(int n, std::vector<std::promise<Base *>>& results,
                                                  std::vector<std::vector<double>>& baseLabels,
                                                  std::vector<Feature*>& baseFeatures,
                                                  std::vector<double>* instancesWeights,
+                                                 std::vector<double>* instancesNorms,
+                                                 Feature** instancesColumns,
                                                  Args& args, int threadId, int threads);
 
     static void trainBasesWithSameFeatures(std::string outfile, int n, std::vector<std::vector<double>>& baseLabels,
                                            std::vector<Feature*>& baseFeatures,
-                                           std::vector<double>* instancesWeights, Args& args);
+                                           std::vector<double>* instancesWeights,
+                                           std::vector<double>* instancesNorms, Args& args);
 
     static void trainBasesWithSameFeatures(std::ofstream& out, int n, std::vector<std::vector<double>>& baseLabels,
                                            std::vector<Feature*>& baseFeatures,
-                                           std::vector<double>* instancesWeights, Args& args);
+                                           std::vector<double>* instancesWeights,
+                                           std::vector<double>* instancesNorms, Args& args);
 
     static void saveResults(std::ofstream& out, std::vector<std::future<Base*>>& results);
 
     static std::vector<Base*> loadBases(std::string infile);
 
-private:
-    static void predictBatchThread(int threadId, Model* model, std::vector<std::vector<Prediction>>& predictions,
-                                   SRMatrix<Feature>& features, Args& args, const int startRow, const int stopRow);
+    // Persistent pool of threads shared by batch predictions, it grows to the largest number of threads requested
+    // and lives until the end of the program, callers use fewer threads by enqueuing fewer tasks
+    static ThreadPool& getThreadPool(int threads);
+
+    // Threads of the pool claim chunks of rows [start, stop) through an atomic cursor until all rows are processed,
+    // at most one thread per chunk is used, calls from the threads of the pool and work for a single thread
+    // are processed in the calling thread
+    static void processRowsInChunks(int rows, int chunkSize, int threads,
+                                    const std::function<void(int start, int stop)>& processChunk);
 
-    static void predictBatchWithThresholdsThread(int threadId, Model* model, std::vector<std::vector<Prediction>>& predictions,
-                                                 SRMatrix<Feature>& features, Args& args, const int startRow, const int stopRow);
+private:
+    static void processChunksThread(int rows, int chunkSize, const std::function<void(int start, int stop)>& processChunk,
+                                    std::atomic<int>& nextRow, std::atomic<int>& doneRows);
 
     static void ofoThread(int threadId, Model* model, std::vector<double>& as, std::vector<double>& bs,
-                          SRMatrix<Feature>& features, SRMatrix<Label>& labels, Args& args,
-                          const int startRow, const int stopRow);
+                          SRMatrix<Feature>& features, SRMatrix<Label>& labels, const PredictOptions& options,
+                          int epochs, const int startRow, const int stopRow);
 };
@@ -5,18 +5,30 @@
 
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <climits>
 #include <cmath>
 #include <list>
+#include <numeric>
 #include <vector>
 
 #include "br.h"
+#include "prediction_context.h"
 #include "threads.h"
 
 
+// Number of labels in the tile of packed weights and number of rows scored together against it
+const int denseLabelsTile = 64;
+const int denseBlockSize = 32;
+// Rows are claimed by the threads in chunks of this size in batched prediction
+const int denseChunkSize = 256;
+// Weights are packed only if this fraction of them is non-zero
+const double minPackedDensity = 0.25;
+
 BR::BR() {
     type = br;
     name = "BR";
+    packedFeatures = 0;
 }
 
 BR::~BR() {
@@ -29,6 +41,10 @@ void BR::train(SRMatrix<Label>& labels, SRMatrix<Feature>& features, Args& args,
     int lCols = labels.cols();
     assert(rows == labels.rows());
 
+    // Squared norms of examples, shared by all the base estimators
+    std::vector<double> norms;
+    if (Base::requiresSquaredNorms(args)) norms = computeSquaredNorms(features);
+
     std::ofstream out(joinPath(output, "weights.bin"));
     int size = lCols;
     out.write((char*)&size, sizeof(size));
@@ -63,40 +79,247 @@ void BR::train(SRMatrix<Label>& labels, SRMatrix<Feature>& features, Args& args,
         unsigned long long usedMem = range * (rows * sizeof(double) + sizeof(void*));
         std::cerr << "  Temporary data size: " << formatMem(usedMem) << std::endl;
 
-        trainBasesWithSameFeatures(out, features.cols(), binLabels, features.allRows(), nullptr, args);
+        trainBasesWithSameFeatures(out, features.cols(), binLabels, features.allRows(), nullptr,
+                                   norms.empty() ? nullptr : &norms, args);
         for (auto& l : binLabels) l.clear();
     }
 
     out.close();
 }
 
-void BR::predict(std::vector<Prediction>& prediction, Feature* features, Args& args) {
-    prediction = predictForAllLabels(features, args);
+void BR::predict(std::vector<Prediction>& prediction, Feature* features, const PredictOptions& options) const {
+    if (!index.empty()) {
+        predictTopLabels(prediction, features, options);
+        return;
+    }
+
+    prediction.clear();
+    predictForAllLabels(prediction, features, options);
 
     sort(prediction.rbegin(), prediction.rend());
-    if (args.threshold > 0) {
+    if (options.threshold > 0) {
         int i = 0;
-        while (prediction[i++].value > args.threshold)
+        while (prediction[i++].value > options.threshold)
             ;
         prediction.resize(i - 1);
     }
-    if (args.topK > 0) prediction.resize(args.topK);
+    if (options.topK > 0) prediction.resize(options.topK);
 }
 
-std::vector<Prediction> BR::predictForAllLabels(Feature* features, Args& args) {
-    std::vector<Prediction> prediction;
-    prediction.reserve(bases.size());
+void BR::predictForAllLabels(std::vector<Prediction>& prediction, Feature* features,
+                             const PredictOptions& options) const {
+    prediction.reserve(prediction.size() + bases.size());
+    if (!index.empty()) {
+        PredictionContext& context = PredictionContext::local();
+        scoreTouchedLabels(features, context);
+        double norm = normalization(context);
+        for (int i = 0; i < bases.size(); ++i)
+            prediction.push_back({i, labelValue(i, context.isTouched[i] ? context.scores[i] : defaultValues[i], norm)});
+        InvertedIndex::clear(context.scores, context.isTouched, context.touched);
+        return;
+    }
+
     for (int i = 0; i < bases.size(); ++i) prediction.push_back({i, bases[i]->predictProbability(features)});
-    return prediction;
 }
 
-void BR::predictWithThresholds(std::vector<Prediction>& prediction, Feature* features, Args& args) {
-    std::vector<Prediction> tmpPrediction = predictForAllLabels(features, args);
+void BR::scoreTouchedLabels(Feature* features, PredictionContext& context) const {
+    index.accumulate(features, context.scores, context.isTouched, context.touched);
+    for (auto l : context.touched) context.scores[l] = bases[l]->valueFromDot(context.scores[l]);
+
+    MetricsCounters& counters = metrics.local();
+    ++counters.dataPoints;
+    counters.nodeEvaluations += context.touched.size();
+    counters.nodesPerDataPoint.add(context.touched.size());
+}
+
+void BR::predictTopLabels(std::vector<Prediction>& prediction, Feature* features,
+                          const PredictOptions& options) const {
+    PredictionContext& context = PredictionContext::local();
+    scoreTouchedLabels(features, context);
+    double norm = normalization(context);
+
+    prediction.clear();
+    for (auto l : context.touched) {
+        double value = labelValue(l, context.scores[l], norm);
+        if (options.threshold <= 0 || value > options.threshold) prediction.push_back({l, value});
+    }
+
+    // Labels not touched by the features can be predicted only in the order of their default values
+    int k = options.topK > 0 ? options.topK : bases.size();
+    int untouched = 0;
+    for (auto l : defaultOrder) {
+        if (untouched >= k) break;
+        if (context.isTouched[l]) continue;
+        double value = labelValue(l, defaultValues[l], norm);
+        if (options.threshold > 0 && value <= options.threshold) break;
+        prediction.push_back({l, value});
+        ++untouched;
+    }
+
+    InvertedIndex::clear(context.scores, context.isTouched, context.touched);
+
+    auto greater = [](const Prediction& a, const Prediction& b) { return a.value > b.value; };
+    if (prediction.size() > k) {
+        std::partial_sort(prediction.begin(), prediction.begin() + k, prediction.end(), greater);
+        prediction.resize(k);
+    } else
+        std::sort(prediction.begin(), prediction.end(), greater);
+}
+
+std::vector<std::vector<Prediction>> BR::predictBatch(SRMatrix<Feature>& features,
+                                                      const PredictOptions& options) const {
+    if (packedW.empty()) return Model::predictBatch(features, options);
+
+    std::cerr << "Starting batched prediction in " << options.threads << " threads ...\n";
+
+    int rows = features.rows();
+    std::vector<std::vector<Prediction>> predictions(rows);
+    processRowsInChunks(rows, denseChunkSize, options.threads, [&](int start, int stop) {
+        auto startTime = std::chrono::steady_clock::now();
+        predictRows(&predictions[start], &features.allRows()[start], stop - start, options);
+
+        // Rows of the chunk are predicted together, so each of them gets the average latency of the chunk
+        uint64_t latency = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - startTime).count() / (stop - start);
+        MetricsCounters& counters = metrics.local();
+        for (int r = start; r < stop; ++r) counters.latency.add(latency);
+    });
+
+    return predictions;
+}
+
+void BR::predictRows(std::vector<Prediction>* predictions, Feature* const* rows, int size,
+                     const PredictOptions& options) const {
+    // Batched scoring selects top k labels, other predictions are made row by row
+    if (packedW.empty() || options.topK <= 0 || (softmaxValues() && options.threshold > 0)) {
+        Model::predictRows(predictions, rows, size, options);
+        return;
+    }
+
+    for (int start = 0; start < size; start += denseBlockSize)
+        predictDenseBlock(predictions + start, rows + start, std::min(denseBlockSize, size - start), options);
+}
+
+void BR::predictDenseBlock(std::vector<Prediction>* predictions, Feature* const* rows, int size,
+                           const PredictOptions& options) const {
+    PredictionContext& context = PredictionContext::local();
+    std::vector<double>& scores = context.blockScores;
+    std::vector<double>& sums = context.blockSums;
+    scores.resize(size * denseLabelsTile);
+    sums.assign(size, 0);
+
+    bool softmax = softmaxValues();
+    auto greater = [](const Prediction& a, const Prediction& b) { return a.value > b.value; };
+    for (int i = 0; i < size; ++i) predictions[i].clear();
+
+    int tiles = (m + denseLabelsTile - 1) / denseLabelsTile;
+    for (int t = 0; t < tiles; ++t) {
+        const Weight* tileW = packedW.data() + static_cast<size_t>(t) * packedFeatures * denseLabelsTile;
+        int tileBegin = t * denseLabelsTile;
+        int tileSize = std::min(denseLabelsTile, m - tileBegin);
+        std::fill(scores.begin(), scores.end(), 0);
+
+        // Tile of weights stays in cache for all the rows of the block, products are added in the order
+        // of the features, so the scores are the same as the dot products of single bases
+        for (int i = 0; i < size; ++i) {
+            double* s = scores.data() + i * denseLabelsTile;
+            for (Feature* f = rows[i]; f->index != -1 && f->index < packedFeatures; ++f) {
+                const Weight* w = tileW + static_cast<size_t>(f->index) * denseLabelsTile;
+                double x = f->value;
+                for (int j = 0; j < denseLabelsTile; ++j) s[j] += w[j] * x;
+            }
+        }
+
+        // Values of the tile's labels are pushed to the min-heaps of top k predictions of the rows,
+        // softmax values are ordered by the values of the bases and normalized at the end
+        for (int i = 0; i < size; ++i) {
+            const double* s = scores.data() + i * denseLabelsTile;
+            std::vector<Prediction>& heap = predictions[i];
+            for (int j = 0; j < tileSize; ++j) {
+                int l = tileBegin + j;
+                double value = bases[l]->valueFromDot(s[j]);
+                if (softmax)
+                    sums[i] += exp(value);
+                else {
+                    value = labelValue(l, value, 1);
+                    if (options.threshold > 0 && value <= options.threshold) continue;
+                }
+
+                if (heap.size() < options.topK) {
+                    heap.push_back({l, value});
+                    std::push_heap(heap.begin(), heap.end(), greater);
+                } else if (value > heap.front().value) {
+                    std::pop_heap(heap.begin(), heap.end(), greater);
+                    heap.back() = {l, value};
+                    std::push_heap(heap.begin(), heap.end(), greater);
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < size; ++i) {
+        std::sort(predictions[i].begin(), predictions[i].end(), greater);
+        if (softmax)
+            for (auto& p : predictions[i]) p.value = labelValue(p.label, p.value, sums[i]);
+    }
+
+    MetricsCounters& counters = metrics.local();
+    counters.dataPoints += size;
+    counters.nodeEvaluations += static_cast<uint64_t>(size) * m;
+    for (int i = 0; i < size; ++i) counters.nodesPerDataPoint.add(m);
+}
+
+void BR::packWeights() {
+    // Only models with all the weights stored densely and mostly non-zero are packed
+    packedFeatures = 0;
+    size_t nonZero = 0, dense = 0;
+    for (auto b : bases) {
+        if (b->isDummy()) continue;
+        if (b->getW() == nullptr) return;
+        packedFeatures = std::max(packedFeatures, b->getWSize());
+        nonZero += b->getNonZeroW();
+        dense += b->getWSize();
+    }
+    if (dense == 0 || nonZero < minPackedDensity * dense) return;
+
+    std::cerr << "Packing dense weights for batched prediction ...\n";
+    int tiles = (m + denseLabelsTile - 1) / denseLabelsTile;
+    packedW.assign(static_cast<size_t>(tiles) * packedFeatures * denseLabelsTile, 0);
+    for (int l = 0; l < m; ++l) {
+        if (bases[l]->isDummy()) continue;
+        Weight* W = bases[l]->getW();
+        Weight* w = packedW.data() + static_cast<size_t>(l / denseLabelsTile) * packedFeatures * denseLabelsTile +
+                    l % denseLabelsTile;
+        for (int f = 0; f < bases[l]->getWSize(); ++f) w[static_cast<size_t>(f) * denseLabelsTile] = W[f];
+    }
+
+    std::cerr << "  Packed weights size: " << formatMem(packedW.size() * sizeof(Weight)) << "\n";
+}
+
+void BR::buildIndex() {
+    std::cerr << "Building inverted index of weights ...\n";
+    index.build(bases);
+
+    defaultValues.resize(bases.size());
+    for (int i = 0; i < bases.size(); ++i) defaultValues[i] = bases[i]->valueFromDot(0);
+    defaultOrder.resize(bases.size());
+    std::iota(defaultOrder.begin(), defaultOrder.end(), 0);
+    std::stable_sort(defaultOrder.begin(), defaultOrder.end(),
+                     [&](int a, int b) { return defaultValues[a] > defaultValues[b]; });
+
+    std::cerr << "  Inverted index size: " << formatMem(index.mem()) << "\n";
+}
+
+void BR::predictWithThresholds(std::vector<Prediction>& prediction, Feature* features,
+                               const PredictOptions& options) const {
+    std::vector<Prediction>& tmpPrediction = PredictionContext::local().predictions;
+    tmpPrediction.clear();
+    predictForAllLabels(tmpPrediction, features, options);
     for (auto& p : tmpPrediction)
         if (p.value >= thresholds[p.label]) prediction.push_back(p);
 }
 
-double BR::predictForLabel(Label label, Feature* features, Args& args) {
+double BR::predictForLabel(Label label, Feature* features, const PredictOptions& options) const {
     return bases[label]->predictProbability(features);
 }
 
@@ -104,11 +327,16 @@ void BR::load(Args& args, std::string infile) {
     std::cerr << "Loading weights ...\n";
     bases = loadBases(joinPath(infile, "weights.bin"));
     m = bases.size();
+    if (args.invertedIndex)
+        buildIndex();
+    else if (args.packWeights && (type == br || type == ovr)) // Other models select labels in their own way
+        packWeights();
 }
 
 void BR::printInfo() {
     std::cerr << name << " additional stats:"
               << "\n  Mean # estimators per data point: " << bases.size() << "\n";
+    Model::printInfo();
 }
 
 size_t BR::calculateNumberOfParts(SRMatrix<Label>& labels, SRMatrix<Feature>& features, Args& args){
@@ -6,7 +6,9 @@
 #pragma once
 
 #include "base.h"
+#include "inverted_index.h"
 #include "model.h"
+#include "prediction_context.h"
 
 
 class BR : public Model {
@@ -15,10 +17,15 @@ public:
     ~BR() override;
 
     void train(SRMatrix<Label>& labels, SRMatrix<Feature>& features, Args& args, std::string output) override;
-    void predict(std::vector<Prediction>& prediction, Feature* features, Args& args) override;
-    double predictForLabel(Label label, Feature* features, Args& args) override;
+    void predict(std::vector<Prediction>& prediction, Feature* features, const PredictOptions& options) const override;
+    double predictForLabel(Label label, Feature* features, const PredictOptions& options) const override;
 
-    void predictWithThresholds(std::vector<Prediction>& prediction, Feature* features, Args& args) override;
+    std::vector<std::vector<Prediction>> predictBatch(SRMatrix<Feature>& features,
+                                                      const PredictOptions& options) const override;
+    void predictRows(std::vector<Prediction>* predictions, Feature* const* rows, int size,
+                     const PredictOptions& options) const override;
+    void predictWithThresholds(std::vector<Prediction>& prediction, Feature* features,
+                               const PredictOptions& options) const override;
 
     void load(Args& args, std::string infile) override;
 
@@ -27,6 +34,39 @@ public:
 protected:
     std::vector<Base*> bases;
 
-    virtual std::vector<Prediction> predictForAllLabels(Feature* features, Args& args);
+    // Inverted index of the weights, built at load time if requested
+    InvertedIndex index;
+    std::vector<double> defaultValues; // Values of the bases for data points without any of their features
+    std::vector<int> defaultOrder; // Labels sorted by default values in descending order
+
+    // Dense weights packed in tiles of labels for batched scoring if requested, weight of the feature f and the label
+    // t * denseLabelsTile + j is at packedW[(t * packedFeatures + f) * denseLabelsTile + j]
+    std::vector<Weight> packedW;
+    int packedFeatures;
+
+    // Appends predictions for all the labels
+    virtual void predictForAllLabels(std::vector<Prediction>& prediction, Feature* features,
+                                     const PredictOptions& options) const;
+
+    virtual void buildIndex();
+    // Sets scores of the context to values of the bases touched by the features
+    void scoreTouchedLabels(Feature* features, PredictionContext& context) const;
+    // Top k or above threshold predictions selected from the touched labels
+    // and the untouched labels with the highest default values
+    void predictTopLabels(std::vector<Prediction>& prediction, Feature* features,
+                          const PredictOptions& options) const;
+    void packWeights();
+    // Scores the block of rows against the packed weights tile by tile and selects top k labels of each row
+    void predictDenseBlock(std::vector<Prediction>* predictions, Feature* const* rows, int size,
+                           const PredictOptions& options) const;
+    // True if values of the labels are normalized over all the labels
+    virtual bool softmaxValues() const { return false; }
+
+    // Normalization computed from the values of the touched labels, used by labelValue
+    virtual double normalization(PredictionContext& context) const { return 1; }
+    // Prediction for the label from the value of its base
+    virtual double labelValue(int label, double value, double norm) const {
+        return bases[label]->probabilityFromValue(value);
+    }
     static size_t calculateNumberOfParts(SRMatrix<Label>& labels, SRMatrix<Feature>& features, Args& args);
 };
@@ -4,6 +4,7 @@
  */
 
 #include "extreme_text.h"
+#include "prediction_context.h"
 #include "threads.h"
 
 
@@ -26,8 +27,8 @@ void ExtremeText::trainThread(int threadId, ExtremeText* model, SRMatrix<Label>&
     }
 }
 
-double ExtremeText::updateNode(TreeNode* node, double label, Vector<XTWeight>& hidden, Vector<XTWeight>& gradient, double lr, double l2){
-    size_t i = node->index;
+double ExtremeText::updateNode(int index, double label, Vector<XTWeight>& hidden, Vector<XTWeight>& gradient, double lr, double l2){
+    size_t i = index;
 
     //double pred = 1.0 / (1.0 + std::exp(-dotVectors(outputW[i], hidden)));
     double val = dotVectors(outputW[i], hidden);
@@ -54,9 +55,11 @@ double ExtremeText::update(double lr, Feature* features, Label* labels, int rSiz
     }
     divVector(hidden, valuesSum);
 
-    // Gather nodes to update
-    UnorderedSet<TreeNode*> nPositive;
-    UnorderedSet<TreeNode*> nNegative;
+    // Gather nodes to update, buffers are reused between the updates made by the same thread
+    static thread_local TreeNodeSet nPositive;
+    static thread_local TreeNodeSet nNegative;
+    nPositive.clear();
+    nNegative.clear();
 
     getNodesToUpdate(nPositive, nNegative, labels, rSize);
 
@@ -86,6 +89,7 @@ void ExtremeText::train(SRMatrix<Label>& labels, SRMatrix<Feature>& features, Ar
         tree->buildTreeStructure(labels, features, args);
     }
     m = tree->getNumberOfLeaves();
+    flatTree = FlatTree(*tree);
 
     dims = args.dims;
     inputW = Matrix<XTWeight>(features.cols(), dims);
@@ -134,32 +138,38 @@ void ExtremeText::load(Args& args, std::string infile) {
 
     assert(tree->t == outputW.rows());
     m = tree->getNumberOfLeaves();
+    flatTree = FlatTree(*tree);
 
     if(!args.thresholds.empty())
         tree->populateNodeLabels();
 }
 
-void ExtremeText::predict(std::vector<Prediction>& prediction, Feature* features, Args& args){
-    Feature* hidden = computeHidden(features);
-    PLT::predict(prediction, hidden, args);
-    delete[] hidden;
+void ExtremeText::predict(std::vector<Prediction>& prediction, Feature* features, const PredictOptions& options) const {
+    Feature* hidden = computeHidden(features, PredictionContext::local().hidden);
+    PLT::predict(prediction, hidden, options);
 }
 
-void ExtremeText::predictWithThresholds(std::vector<Prediction>& prediction, Feature* features, Args& args){
-    Feature* hidden = computeHidden(features);
-    PLT::predictWithThresholds(prediction, hidden, args);
-    delete[] hidden;
+void ExtremeText::predictWithThresholds(std::vector<Prediction>& prediction, Feature* features,
+                                        const PredictOptions& options) const {
+    Feature* hidden = computeHidden(features, PredictionContext::local().hidden);
+    PLT::predictWithThresholds(prediction, hidden, options);
 }
 
-double ExtremeText::predictForLabel(Label label, Feature* features, Args& args){
-    Feature* hidden = computeHidden(features);
-    double value = PLT::predictForLabel(label, hidden, args);
-    delete[] hidden;
+double ExtremeText::predictForLabel(Label label, Feature* features, const PredictOptions& options) const {
+    Feature* hidden = computeHidden(features, PredictionContext::local().hidden);
+    double value = PLT::predictForLabel(label, hidden, options);
     return value;
 }
 
-Feature* ExtremeText::computeHidden(Feature* features){
-    Feature* hidden = new Feature[dims + 1];
+void ExtremeText::predictForLabels(std::vector<double>& values, const std::vector<Label>& labels, Feature* features,
+                                   const PredictOptions& options) const {
+    Feature* hidden = computeHidden(features, PredictionContext::local().hidden);
+    PLT::predictForLabels(values, labels, hidden, options);
+}
+
+Feature* ExtremeText::computeHidden(Feature* features, std::vector<Feature>& hiddenBuffer) const {
+    hiddenBuffer.resize(dims + 1);
+    Feature* hidden = hiddenBuffer.data();
     for(size_t i = 0; i < dims; ++i) {
         hidden[i].index = i;
         hidden[i].value = 0;
@@ -15,10 +15,19 @@ public:
 
     void train(SRMatrix<Label>& labels, SRMatrix<Feature>& features, Args& args, std::string output) override;
 
-    void predict(std::vector<Prediction>& prediction, Feature* features, Args& args) override;
-    double predictForLabel(Label label, Feature* features, Args& args) override;
+    void predict(std::vector<Prediction>& prediction, Feature* features, const PredictOptions& options) const override;
 
-    void predictWithThresholds(std::vector<Prediction>& prediction, Feature* features, Args& args) override;
+    // Nodes are evaluated for the hidden representation computed by predict, so examples are predicted one by one
+    std::vector<std::vector<Prediction>> predictBatch(SRMatrix<Feature>& features,
+                                                      const PredictOptions& options) const override {
+        return Model::predictBatch(features, options);
+    }
+    double predictForLabel(Label label, Feature* features, const PredictOptions& options) const override;
+    void predictForLabels(std::vector<double>& values, const std::vector<Label>& labels, Feature* features,
+                          const PredictOptions& options) const override;
+
+    void predictWithThresholds(std::vector<Prediction>& prediction, Feature* features,
+                               const PredictOptions& options) const override;
 
     void load(Args& args, std::string infile) override;
 
@@ -28,12 +37,13 @@ protected:
     int dims;
 
     double update(double lr, Feature* features, Label* labels, int rSize, Args& args);
-    double updateNode(TreeNode* node, double label, Vector<XTWeight>& hidden, Vector<XTWeight>& gradient, double lr, double l2);
+    double updateNode(int index, double label, Vector<XTWeight>& hidden, Vector<XTWeight>& gradient, double lr, double l2);
 
-    Feature* computeHidden(Feature* features);
+    // Computes the hidden representation in the given buffer
+    Feature* computeHidden(Feature* features, std::vector<Feature>& hiddenBuffer) const;
 
-    inline double predictForNode(TreeNode* node, Feature* features) override {
-        return 1.0 / (1.0 + std::exp(-dotVectors(features, outputW[node->index])));
+    inline double predictForNode(int node, Feature* features) const override {
+        return 1.0 / (1.0 + std::exp(-dotVectors(features, outputW[flatTree.index[node]])));
     };
 
     static void trainThread(int threadId, ExtremeText* model, SRMatrix<Label>& labels,
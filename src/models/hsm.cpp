@@ -12,160 +12,186 @@
 #include <vector>
 
 #include "hsm.h"
+#include "prediction_context.h"
 #include "threads.h"
 
 
 HSM::HSM() {
-    pathLength = 0;
     name = "HSM";
     type = hsm;
 }
 
-void HSM::assignDataPoints(std::vector<std::vector<double>>& binLabels, std::vector<std::vector<Feature*>>& binFeatures,
-                           std::vector<std::vector<double>*>* binWeights, SRMatrix<Label>& labels,
-                           SRMatrix<Feature>& features, Args& args) {
-    std::cerr << "Assigning data points to nodes ...\n";
+void HSM::assignDataPoint(AssignedDataPoints& assigned, Label* rLabels, int rSize, Feature* rFeatures, Args& args) {
+    assigned.nPositive.clear();
+    assigned.nNegative.clear();
 
-    // Positive and negative nodes
-    UnorderedSet<TreeNode*> nPositive;
-    UnorderedSet<TreeNode*> nNegative;
-
-    // Gather examples for each node
-    int rows = features.rows();
-    for (int r = 0; r < rows; ++r) {
-        printProgress(r, rows);
-
-        nPositive.clear();
-        nNegative.clear();
-
-        auto rSize = labels.size(r);
-        auto rLabels = labels[r];
+    // Check row
+    if (!args.pickOneLabelWeighting && rSize != 1) {
+        std::cerr << "Encountered example with " << rSize
+                  << " labels HSM is multi-class classifier, use PLT instead\n";
+        return;
+    }
 
-        // Check row
-        if (!args.pickOneLabelWeighting && rSize != 1) {
-            std::cerr << "Encountered example with " << rSize
-                      << " labels HSM is multi-class classifier, use PLT instead\n";
-            continue;
+    for (int i = 0; i < rSize; ++i) {
+        assigned.pathLength += getNodesToUpdate(assigned.nPositive, assigned.nNegative, rLabels[i]);
+        addNodesLabelsAndFeatures(assigned, rFeatures);
+        if (!assigned.binWeights.empty()) {
+            double w = 1.0 / rSize;
+            for (const auto& n : assigned.nPositive) assigned.binWeights[n].push_back(w);
+            for (const auto& n : assigned.nNegative) assigned.binWeights[n].push_back(w);
         }
 
-        for (int i = 0; i < rSize; ++i) {
-            getNodesToUpdate(nPositive, nNegative, rLabels[i]);
-            addNodesLabelsAndFeatures(binLabels, binFeatures, nPositive, nNegative, features[r]);
-            if (args.pickOneLabelWeighting) {
-                double w = 1.0 / rSize;
-                for (const auto& n : nPositive) (*binWeights)[n->index]->push_back(w);
-                for (const auto& n : nNegative) (*binWeights)[n->index]->push_back(w);
-            }
-
-            nodeUpdateCount += nPositive.size() + nNegative.size();
-        }
-        ++dataPointCount;
+        assigned.nodeUpdateCount += assigned.nPositive.size() + assigned.nNegative.size();
     }
+    ++assigned.dataPointCount;
 }
 
-void HSM::getNodesToUpdate(UnorderedSet<TreeNode*>& nPositive, UnorderedSet<TreeNode*>& nNegative,
-                           const int rLabel) {
-
-    std::vector<TreeNode*> path;
-
-    auto ni = tree->leaves.find(rLabel);
-    if (ni == tree->leaves.end()) {
+int HSM::getNodesToUpdate(TreeNodeSet& nPositive, TreeNodeSet& nNegative, const int rLabel) {
+    const FlatTree& ft = flatTree;
+    int l = ft.leaf(rLabel);
+    if (l == -1) {
         std::cerr << "Encountered example with label " << rLabel << " that does not exists in the tree\n";
-        return;
-    }
-    TreeNode* n = ni->second;
-    path.push_back(n);
-    while (n->parent) {
-        n = n->parent;
-        path.push_back(n);
+        return 0;
     }
 
-    assert(path.size());
-    assert(path.back() == tree->root);
-
-    for (int i = path.size() - 1; i >= 0; --i) {
-        TreeNode *n = path[i], *p = n->parent;
-        if (p == nullptr || p->children.size() == 1) {
-            nPositive.insert(n);
-        } else if (p->children.size() == 2) { // Binary node requires just 1 probability estimator
-            TreeNode *c0 = n->parent->children[0];
-            if (c0 == n) nPositive.insert(c0);
-            else nNegative.insert(c0);
-        } else if (p->children.size() > 2) { // Node with arity > 2 requires OVR estimator
-            for (const auto& c : p->children) {
-                if (c == n) nPositive.insert(c);
-                else nNegative.insert(c);
+    // Go up the path from the leaf to the root
+    int pathLength = 0;
+    for (int n = l; n != -1; n = ft.parent[n]) {
+        int p = ft.parent[n];
+        int cBegin = p != -1 ? ft.childrenBegin(p) : n, cEnd = p != -1 ? ft.childrenEnd(p) : n + 1;
+        if (cEnd - cBegin == 1) {
+            nPositive.insert(ft.index[n]);
+        } else if (cEnd - cBegin == 2) { // Binary node requires just 1 probability estimator
+            if (cBegin == n) nPositive.insert(ft.index[cBegin]);
+            else nNegative.insert(ft.index[cBegin]);
+        } else { // Node with arity > 2 requires OVR estimator
+            for (int c = cBegin; c < cEnd; ++c) {
+                if (c == n) nPositive.insert(ft.index[c]);
+                else nNegative.insert(ft.index[c]);
             }
         }
+        ++pathLength;
     }
 
-    pathLength += path.size();
+    assert(pathLength);
+    return pathLength;
 }
 
-Prediction HSM::predictNextLabel(TopKQueue<TreeNodeValue>& nQueue, Feature* features, double threshold) {
+Prediction HSM::predictNextLabel(TopKQueue<FlatNodeValue>& nQueue, Feature* features, double threshold) const {
 
     while (!nQueue.empty()) {
-        TreeNodeValue nVal = nQueue.top();
+        FlatNodeValue nVal = nQueue.top();
         nQueue.pop();
 
-        if (!nVal.node->children.empty()) {
-            if (nVal.node->children.size() == 2) {
-                double value = bases[nVal.node->children[0]->index]->predictProbability(features);
-                addToQueue(nQueue, nVal.node->children[0], nVal.value * value, threshold);
-                addToQueue(nQueue, nVal.node->children[1], nVal.value * (1.0 - value), threshold);
-                ++nodeEvaluationCount;
-            } else {
-                double sum = 0;
-                std::vector<double> values;
-                values.reserve(nVal.node->children.size());
-                for (const auto& child : nVal.node->children) {
-                    values.emplace_back(std::exp(bases[child->index]->predictValue(features))); // Softmax normalization
-                    sum += values.back();
-                }
-
-                for (int i = 0; i < nVal.node->children.size(); ++i)
-                    addToQueue(nQueue, nVal.node->children[i], nVal.value * values[i] / sum, threshold);
-
-                nodeEvaluationCount += nVal.node->children.size();
+        int cBegin = flatTree.childrenBegin(nVal.node), cEnd = flatTree.childrenEnd(nVal.node);
+        if (cEnd - cBegin == 2) {
+            double value = bases[flatTree.index[cBegin]]->predictProbability(features);
+            addToQueue(nQueue, cBegin, nVal.value * value, threshold);
+            addToQueue(nQueue, cBegin + 1, nVal.value * (1.0 - value), threshold);
+            ++metrics.local().nodeEvaluations;
+        } else if (cEnd - cBegin > 0) {
+            double sum = 0;
+            std::vector<double>& values = PredictionContext::local().values;
+            values.clear();
+            for (int c = cBegin; c < cEnd; ++c) {
+                values.emplace_back(std::exp(bases[flatTree.index[c]]->predictValue(features))); // Softmax normalization
+                sum += values.back();
             }
+
+            for (int c = cBegin; c < cEnd; ++c)
+                addToQueue(nQueue, c, nVal.value * values[c - cBegin] / sum, threshold);
+
+            metrics.local().nodeEvaluations += cEnd - cBegin;
         }
-        if (nVal.node->label >= 0) return {nVal.node->label, nVal.value};
+        if (flatTree.label[nVal.node] >= 0) return {flatTree.label[nVal.node], nVal.value};
     }
 
     return {-1, 0};
 }
 
-double HSM::predictForLabel(Label label, Feature* features, Args& args) {
-    double value = 0;
-    TreeNode* n = tree->leaves[label];
-    while (n->parent) {
-        if (n->parent->children.size() == 2) {
-            if (n == n->parent->children[0])
-                value *= bases[n->children[0]->index]->predictProbability(features);
-            else
-                value *= 1.0 - bases[n->children[0]->index]->predictProbability(features);
-            ++nodeEvaluationCount;
+void HSM::predictChildren(std::vector<FlatNodeValue>& nValues, int node, double value, Feature* features) const {
+    int cBegin = flatTree.childrenBegin(node), cEnd = flatTree.childrenEnd(node);
+    if (cEnd - cBegin == 2) {
+        double c0Value = bases[flatTree.index[cBegin]]->predictProbability(features);
+        nValues.push_back({cBegin, value * c0Value});
+        nValues.push_back({cBegin + 1, value * (1.0 - c0Value)});
+        ++metrics.local().nodeEvaluations;
+    } else if (cEnd - cBegin > 0) {
+        double sum = 0;
+        size_t first = nValues.size();
+        for (int c = cBegin; c < cEnd; ++c) {
+            nValues.push_back({c, std::exp(bases[flatTree.index[c]]->predictValue(features))}); // Softmax normalization
+            sum += nValues.back().value;
+        }
+        for (size_t i = first; i < nValues.size(); ++i) nValues[i].value = value * nValues[i].value / sum;
+        metrics.local().nodeEvaluations += cEnd - cBegin;
+    }
+}
+
+double HSM::predictForLabel(Label label, Feature* features, const PredictOptions& options) const {
+    int n = flatTree.leaf(label);
+    if (n == -1) return 0;
+
+    double value = 1;
+    for (int p = flatTree.parent[n]; p != -1; n = p, p = flatTree.parent[n]) {
+        int cBegin = flatTree.childrenBegin(p), cEnd = flatTree.childrenEnd(p);
+        if (cEnd - cBegin == 2) {
+            double c0Value = bases[flatTree.index[cBegin]]->predictProbability(features);
+            value *= (n == cBegin) ? c0Value : 1.0 - c0Value;
+            ++metrics.local().nodeEvaluations;
         } else {
             double sum = 0;
             double tmpValue = 0;
-            for (const auto& child : n->parent->children) {
-                if (child == n) {
-                    tmpValue = std::exp(bases[child->index]->predictValue(features)); // Softmax normalization
-                    sum += tmpValue;
-                } else
-                    sum += std::exp(bases[child->index]->predictValue(features));
+            for (int c = cBegin; c < cEnd; ++c) {
+                double cValue = std::exp(bases[flatTree.index[c]]->predictValue(features)); // Softmax normalization
+                if (c == n) tmpValue = cValue;
+                sum += cValue;
             }
             value *= tmpValue / sum;
-            nodeEvaluationCount += n->parent->children.size();
+            metrics.local().nodeEvaluations += cEnd - cBegin;
         }
-        n = n->parent;
     }
 
     return value;
 }
 
-void HSM::printInfo() {
-    PLT::printInfo();
-    if(pathLength > 0)
-        std::cout << "  Path length: " << static_cast<double>(pathLength) / dataPointCount << "\n";
+void HSM::predictForLabels(std::vector<double>& values, const std::vector<Label>& labels, Feature* features,
+                           const PredictOptions& options) const {
+    // Normalized values of the children of the nodes shared by the labels' paths are computed only once
+    UnorderedMap<int, double> nodesValues;
+    auto nodeValue = [&](int n) {
+        auto nV = nodesValues.find(n);
+        if (nV != nodesValues.end()) return nV->second;
+
+        int p = flatTree.parent[n];
+        int cBegin = flatTree.childrenBegin(p), cEnd = flatTree.childrenEnd(p);
+        if (cEnd - cBegin == 2) {
+            double c0Value = bases[flatTree.index[cBegin]]->predictProbability(features);
+            nodesValues.insert({cBegin, c0Value});
+            nodesValues.insert({cBegin + 1, 1.0 - c0Value});
+            ++metrics.local().nodeEvaluations;
+        } else {
+            double sum = 0;
+            std::vector<double> cValues;
+            for (int c = cBegin; c < cEnd; ++c) {
+                cValues.push_back(std::exp(bases[flatTree.index[c]]->predictValue(features))); // Softmax normalization
+                sum += cValues.back();
+            }
+            for (int c = cBegin; c < cEnd; ++c) nodesValues.insert({c, cValues[c - cBegin] / sum});
+            metrics.local().nodeEvaluations += cEnd - cBegin;
+        }
+        return nodesValues[n];
+    };
+
+    values.resize(labels.size());
+    for (size_t i = 0; i < labels.size(); ++i) {
+        int n = flatTree.leaf(labels[i]);
+        if (n == -1) {
+            values[i] = 0;
+            continue;
+        }
+        double value = 1;
+        for (; flatTree.parent[n] != -1; n = flatTree.parent[n]) value *= nodeValue(n);
+        values[i] = value;
+    }
 }
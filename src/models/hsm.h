@@ -22,15 +22,15 @@ class HSM : public BatchPLT { // HSM is multi-class version of PLT
 public:
     HSM();
 
-    double predictForLabel(Label label, Feature* features, Args& args) override;
-    void printInfo() override;
+    double predictForLabel(Label label, Feature* features, const PredictOptions& options) const override;
+    void predictForLabels(std::vector<double>& values, const std::vector<Label>& labels, Feature* features,
+                          const PredictOptions& options) const override;
 
 protected:
-    void assignDataPoints(std::vector<std::vector<double>>& binLabels, std::vector<std::vector<Feature*>>& binFeatures,
-                          std::vector<std::vector<double>*>* binWeights, SRMatrix<Label>& labels,
-                          SRMatrix<Feature>& features, Args& args) override;
-    void getNodesToUpdate(UnorderedSet<TreeNode*>& nPositive, UnorderedSet<TreeNode*>& nNegative, const int rLabel);
-    Prediction predictNextLabel(TopKQueue<TreeNodeValue>& nQueue, Feature* features, double threshold) override;
-
-    int pathLength;   // Length of the path
+    void assignDataPoint(AssignedDataPoints& assigned, Label* rLabels, int rSize, Feature* rFeatures,
+                         Args& args) override;
+    // Returns length of the path from the label's leaf to the root
+    int getNodesToUpdate(TreeNodeSet& nPositive, TreeNodeSet& nNegative, const int rLabel);
+    Prediction predictNextLabel(TopKQueue<FlatNodeValue>& nQueue, Feature* features, double threshold) const override;
+    void predictChildren(std::vector<FlatNodeValue>& nValues, int node, double value, Feature* features) const override;
 };
@@ -0,0 +1,77 @@
+/**
+ * Copyright (c) 2020 by Marek Wydmuch
+ * All rights reserved.
+ */
+
+#include <algorithm>
+
+#include "inverted_index.h"
+
+
+InvertedIndex::InvertedIndex() : labelsCount(0), featuresCount(0) {}
+
+void InvertedIndex::build(std::vector<Base*>& bases) {
+    labelsCount = bases.size();
+
+    // Count postings of the features, weights of dummy bases are not needed
+    std::vector<size_t> counts;
+    for (auto b : bases) {
+        if (b->isDummy()) continue;
+        b->forEachIW([&](const int& i, Weight& w) {
+            if (w == 0) return;
+            if (i >= counts.size()) counts.resize(i + 1, 0);
+            ++counts[i];
+        });
+    }
+
+    featuresCount = counts.size();
+    offsets.assign(featuresCount + 1, 0);
+    for (int f = 0; f < featuresCount; ++f) offsets[f + 1] = offsets[f] + counts[f];
+
+    // Postings of the features are filled in the order of labels
+    labels.resize(offsets.back());
+    weights.resize(offsets.back());
+    std::vector<size_t> next(offsets.begin(), offsets.end() - 1);
+    for (int l = 0; l < labelsCount; ++l) {
+        if (bases[l]->isDummy()) continue;
+        bases[l]->forEachIW([&](const int& i, Weight& w) {
+            if (w == 0) return;
+            labels[next[i]] = l;
+            weights[next[i]] = w;
+            ++next[i];
+        });
+    }
+}
+
+size_t InvertedIndex::mem() const {
+    return offsets.size() * sizeof(size_t) + labels.size() * (sizeof(int) + sizeof(Weight));
+}
+
+void InvertedIndex::accumulate(Feature* features, std::vector<double>& scores, std::vector<char>& isTouched,
+                               std::vector<int>& touched) const {
+    if (scores.size() < labelsCount) {
+        scores.resize(labelsCount, 0);
+        isTouched.resize(labelsCount, 0);
+    }
+
+    // Products are added in the order of the features, the same as in the dot product of a single base
+    for (Feature* f = features; f->index != -1; ++f) {
+        if (f->index >= featuresCount) continue;
+        for (size_t i = offsets[f->index]; i < offsets[f->index + 1]; ++i) {
+            int l = labels[i];
+            if (!isTouched[l]) {
+                isTouched[l] = 1;
+                touched.push_back(l);
+            }
+            scores[l] += weights[i] * f->value;
+        }
+    }
+}
+
+void InvertedIndex::clear(std::vector<double>& scores, std::vector<char>& isTouched, std::vector<int>& touched) {
+    for (auto l : touched) {
+        scores[l] = 0;
+        isTouched[l] = 0;
+    }
+    touched.clear();
+}
@@ -0,0 +1,37 @@
+/**
+ * Copyright (c) 2020 by Marek Wydmuch
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "base.h"
+#include "types.h"
+
+// Weights of the bases transposed to lists of (label, weight) postings of the features,
+// so only the labels that have non-zero weights for the data point's features are scored
+class InvertedIndex {
+public:
+    InvertedIndex();
+
+    void build(std::vector<Base*>& bases);
+    inline bool empty() const { return offsets.empty(); }
+    size_t mem() const;
+
+    // Adds dot products of the features and the weights to the scores of the labels,
+    // labels scored for the first time are marked and appended to touched
+    void accumulate(Feature* features, std::vector<double>& scores, std::vector<char>& isTouched,
+                    std::vector<int>& touched) const;
+
+    // Zeros scores and marks of the touched labels, so the buffers can be reused
+    static void clear(std::vector<double>& scores, std::vector<char>& isTouched, std::vector<int>& touched);
+
+private:
+    int labelsCount;
+    int featuresCount;
+    std::vector<size_t> offsets; // Postings of feature f are in range [offsets[f], offsets[f + 1])
+    std::vector<int> labels;
+    std::vector<Weight> weights;
+};
@@ -10,14 +10,103 @@
 
 #include "kmeans.h"
 #include "misc.h"
+#include "threads.h"
+
+// Remaps features of the points to the local feature space of the partition,
+// so centroids are allocated, updated and normalized only over the features present in the partition.
+// Returns the number of local features
+static int remapPartition(std::vector<Assignation>* partition, SRMatrix<Feature>& pointsFeatures,
+                          std::vector<Feature>& localPointsData, std::vector<Feature*>& localPoints) {
+    int points = partition->size();
+
+    // Map from global to local indices is reused between the calls made by the same thread and cleared after use
+    static thread_local std::vector<int> localIndices;
+    if (localIndices.size() < pointsFeatures.cols()) localIndices.resize(pointsFeatures.cols(), -1);
+
+    std::vector<int> localFeatures;
+    size_t localPointsSize = 0;
+    for (const auto& p : *partition) {
+        for (Feature* f = pointsFeatures[p.index]; f->index != -1; ++f) {
+            if (localIndices[f->index] == -1) {
+                localIndices[f->index] = 0;
+                localFeatures.push_back(f->index);
+            }
+        }
+        localPointsSize += pointsFeatures.size(p.index) + 1;
+    }
+    // Local features keep the global order, so the results are the same as in the global feature space
+    std::sort(localFeatures.begin(), localFeatures.end());
+    for (int i = 0; i < localFeatures.size(); ++i) localIndices[localFeatures[i]] = i;
+
+    localPointsData.reserve(localPointsSize);
+    std::vector<size_t> localPointsStart(points);
+    for (int i = 0; i < points; ++i) {
+        localPointsStart[i] = localPointsData.size();
+        for (Feature* f = pointsFeatures[(*partition)[i].index]; f->index != -1; ++f)
+            localPointsData.push_back({localIndices[f->index], f->value});
+        localPointsData.push_back({-1, 0});
+    }
+    for (const auto& f : localFeatures) localIndices[f] = -1;
+
+    localPoints.resize(points);
+    for (int i = 0; i < points; ++i) localPoints[i] = localPointsData.data() + localPointsStart[i];
+
+    return localFeatures.size();
+}
+
+// Calculates similarities of the range of points to centroids
+static void computeSimilaritiesThread(std::vector<Similarities>& similarities, std::vector<Feature*>& points,
+                                      std::vector<std::vector<double>>& centroidsFeatures, int startRow, int stopRow) {
+    int centroids = centroidsFeatures.size();
+    for (int i = startRow; i < stopRow; ++i) {
+        similarities[i].index = i;
+        for (int j = 0; j < centroids; ++j) {
+            similarities[i].values[j].index = j;
+            similarities[i].values[j].value = dotVectors(points[i], centroidsFeatures[j]);
+        }
+
+        if (centroids == 2) // Faster version for 2-means
+            similarities[i].sortby = similarities[i].values[0].value - similarities[i].values[1].value;
+        else {
+            std::sort(similarities[i].values.begin(), similarities[i].values.end(),
+                      [](const Feature& a, const Feature& b) -> bool
+                      {
+                          return a.value > b.value;
+                      });
+            similarities[i].sortby = similarities[i].values[0].value;
+        }
+    }
+}
+
+// Sums the range of features of the centroids over all the points, features of the points are sorted,
+// so only the part of the point within the range is visited. Each feature is summed in the order of the points,
+// so the result does not depend on how the features are split between threads
+static void sumCentroidsThread(std::vector<std::vector<double>>& centroidsFeatures, std::vector<Feature*>& points,
+                               std::vector<Feature>& pointsData, std::vector<Assignation>* partition,
+                               int startFeature, int stopFeature) {
+    for (auto& c : centroidsFeatures) std::fill(c.begin() + startFeature, c.begin() + stopFeature, 0);
+
+    // Points are stored one after another with the termination features in between
+    Feature* pointsEnd = pointsData.data() + pointsData.size() - 1;
+    for (int i = 0; i < points.size(); ++i) {
+        Feature* end = (i + 1 < points.size()) ? points[i + 1] - 1 : pointsEnd;
+        Feature* f = std::lower_bound(points[i], end, startFeature,
+                                      [](const Feature& a, int index) { return a.index < index; });
+        std::vector<double>& c = centroidsFeatures[(*partition)[i].value];
+        for (; f != end && f->index < stopFeature; ++f) c[f->index] += f->value;
+    }
+}
 
 // K-Means clustering with balanced option
 // Partition is returned via reference, calculated for cosine distance
 void kMeans(std::vector<Assignation>* partition, SRMatrix<Feature>& pointsFeatures, int centroids, double eps,
-            bool balanced, int seed) {
+            bool balanced, int seed, int threads) {
 
     int points = partition->size();
-    int features = pointsFeatures.cols();
+
+    std::vector<Feature> localPointsData;
+    std::vector<Feature*> localPoints;
+    int features = remapPartition(partition, pointsFeatures, localPointsData, localPoints);
 
     // if(balanced) std::cerr << "Balanced K-Means ...\n  Partition: " << partition->size() << ", centroids: " <<
     // centroids << "\n";
@@ -34,10 +123,10 @@ void kMeans(std::vector<Assignation>* partition, SRMatrix<Feature>& pointsFeatur
     std::vector<std::vector<double>> centroidsFeatures(centroids);
 
     std::default_random_engine rng(seed);
-    std::uniform_int_distribution<int> dist(0, points);
+    std::uniform_int_distribution<int> dist(0, points - 1);
     for (int i = 0; i < centroids; ++i) {
         centroidsFeatures[i].resize(features, 0);
-        setVector(pointsFeatures[dist(rng)], centroidsFeatures[i]);
+        setVector(localPoints[dist(rng)], centroidsFeatures[i]);
     }
 
     double oldCos = INT_MIN, newCos = -1;
@@ -46,22 +135,28 @@ void kMeans(std::vector<Assignation>* partition, SRMatrix<Feature>& pointsFeatur
     for (int i = 0; i < points; ++i)
         similarities[i].values.resize(centroids);
 
+    // Large partitions are split between threads, by points for similarities and by features for centroids,
+    // so the result does not depend on the number of threads
+    threads = std::max(1, std::min(threads, points / minPointsPerThread));
+    int tRows = ceil(static_cast<double>(points) / threads);
+    int tFeatures = ceil(static_cast<double>(features) / threads);
+    ThreadSet tSet;
+
     while (newCos - oldCos >= eps) {
 
         oldCos = newCos;
         newCos = 0;
 
-        if(centroids == 2){ // Faster version for 2-means
+        // Calculate similarity to centroids
+        if (threads > 1) {
+            for (int t = 0; t < threads; ++t)
+                tSet.add(computeSimilaritiesThread, std::ref(similarities), std::ref(localPoints),
+                         std::ref(centroidsFeatures), std::min(t * tRows, points), std::min((t + 1) * tRows, points));
+            tSet.joinAll();
+        } else
+            computeSimilaritiesThread(similarities, localPoints, centroidsFeatures, 0, points);
 
-            // Calculate similarity to centroids
-            for (int i = 0; i < points; ++i) {
-                similarities[i].index = i;
-                for (int j = 0; j < centroids; ++j) {
-                    similarities[i].values[j].index = j;
-                    similarities[i].values[j].value = dotVectors(pointsFeatures[(*partition)[i].index], centroidsFeatures[j]);
-                }
-                similarities[i].sortby = similarities[i].values[0].value - similarities[i].values[1].value;
-            }
+        if(centroids == 2){ // Faster version for 2-means
 
             // Assign points to centroids and calculate new loss
             std::sort(similarities.begin(), similarities.end());
@@ -76,21 +171,6 @@ void kMeans(std::vector<Assignation>* partition, SRMatrix<Feature>& pointsFeatur
         } else {
             std::vector<int> centroidsSizes(centroids, 0);
 
-            for (int i = 0; i < points; ++i) {
-                similarities[i].index = i;
-                for (int j = 0; j < centroids; ++j) {
-                    similarities[i].values[j].index = j;
-                    similarities[i].values[j].value = dotVectors(pointsFeatures[(*partition)[i].index], centroidsFeatures[j]);
-                }
-
-                std::sort(similarities[i].values.begin(), similarities[i].values.end(),
-                        [](const Feature& a, const Feature& b) -> bool
-                    {
-                        return a.value > b.value;
-                    });
-                similarities[i].sortby = similarities[i].values[0].value;
-            }
-
             // Assign points to centroids and calculate new loss
             std::sort(similarities.rbegin(), similarities.rend());
 
@@ -116,10 +196,158 @@ void kMeans(std::vector<Assignation>* partition, SRMatrix<Feature>& pointsFeatur
         newCos /= points;
 
         // Update centroids
-        for (auto& c : centroidsFeatures) std::fill(c.begin(), c.end(), 0);
-        for (auto& p : (*partition)) addVector(pointsFeatures[p.index], centroidsFeatures[p.value]);
-        for (auto& c : centroidsFeatures) unitNorm(c);
+        if (threads > 1) {
+            for (int t = 0; t < threads; ++t)
+                tSet.add(sumCentroidsThread, std::ref(centroidsFeatures), std::ref(localPoints),
+                         std::ref(localPointsData), partition, std::min(t * tFeatures, features),
+                         std::min((t + 1) * tFeatures, features));
+            tSet.joinAll();
+            for (auto& c : centroidsFeatures) unitNorm(c);
+        } else {
+            for (auto& c : centroidsFeatures) std::fill(c.begin(), c.end(), 0);
+            for (int i = 0; i < points; ++i) addVector(localPoints[i], centroidsFeatures[(*partition)[i].value]);
+            for (auto& c : centroidsFeatures) unitNorm(c);
+        }
     }
 
     //std::cerr << Final similarity: << newCos << "\n";
 }
+
+// Mini-batch spherical K-Means with balanced option
+// Partition is returned via reference, calculated for cosine distance
+void miniBatchKMeans(std::vector<Assignation>* partition, SRMatrix<Feature>& pointsFeatures, int centroids,
+                     double eps, bool balanced, int batchSize, int seed, int threads) {
+
+    int points = partition->size();
+
+    std::vector<Feature> localPointsData;
+    std::vector<Feature*> localPoints;
+    int features = remapPartition(partition, pointsFeatures, localPointsData, localPoints);
+
+    // Centroids are kept as sums of the assigned points, the centroid is the sum divided by its norm,
+    // so adding a point is a sparse operation and the norm is updated incrementally
+    std::vector<std::vector<double>> centroidsSums(centroids);
+    std::vector<double> centroidsNorms(centroids);
+
+    std::default_random_engine rng(seed);
+    std::uniform_int_distribution<int> dist(0, points - 1);
+    for (int i = 0; i < centroids; ++i) {
+        Feature* p = localPoints[dist(rng)];
+        centroidsSums[i].resize(features, 0);
+        setVector(p, centroidsSums[i]);
+        centroidsNorms[i] = squaredNorm(p);
+    }
+
+    // Points of the batch are assigned to the centroids in a balanced way,
+    // using partial selection for 2-means and greedy assignment in the order of the best similarity for more centroids
+    std::vector<Similarities> similarities(batchSize);
+    for (auto& s : similarities) s.values.resize(centroids);
+    std::vector<int> batchPoints(batchSize), batchAssignment(batchSize);
+    int batchPartitionSize = balanced ? (batchSize + centroids - 1) / centroids : batchSize;
+
+    // Similarity is averaged over windows of batches, the clustering stops when it does not improve by eps
+    // or when the number of sampled points reaches the size of the partition (but not before the first window)
+    const int windowBatches = 10;
+    double oldCos = INT_MIN, newCos = -1, windowCos = 0;
+    long long maxSampled = std::max(static_cast<long long>(points), static_cast<long long>(windowBatches) * batchSize);
+    long long sampled = 0;
+
+    for (int b = 1; sampled < maxSampled; ++b) {
+        for (int i = 0; i < batchSize; ++i) {
+            batchPoints[i] = dist(rng);
+            Feature* p = localPoints[batchPoints[i]];
+            similarities[i].index = i;
+            for (int j = 0; j < centroids; ++j) {
+                similarities[i].values[j].index = j;
+                double norm = centroidsNorms[j] > 0 ? std::sqrt(centroidsNorms[j]) : 1;
+                similarities[i].values[j].value = dotVectors(p, centroidsSums[j]) / norm;
+            }
+        }
+
+        if (centroids == 2) {
+            for (auto& s : similarities) s.sortby = s.values[0].value - s.values[1].value;
+            if (balanced) {
+                std::nth_element(similarities.begin(), similarities.begin() + batchSize / 2, similarities.end());
+                for (int i = 0; i < batchSize; ++i) batchAssignment[similarities[i].index] = i < batchSize / 2 ? 1 : 0;
+            } else
+                for (auto& s : similarities) batchAssignment[s.index] = s.sortby <= 0 ? 1 : 0;
+        } else {
+            for (auto& s : similarities) {
+                std::sort(s.values.begin(), s.values.end(),
+                          [](const Feature& a, const Feature& b) -> bool { return a.value > b.value; });
+                s.sortby = s.values[0].value;
+            }
+            std::sort(similarities.rbegin(), similarities.rend());
+            std::vector<int> centroidsSizes(centroids, 0);
+            for (auto& s : similarities) {
+                for (const auto& v : s.values) {
+                    if (centroidsSizes[v.index] < batchPartitionSize) {
+                        batchAssignment[s.index] = v.index;
+                        ++centroidsSizes[v.index];
+                        break;
+                    }
+                }
+            }
+        }
+
+        // Update centroids, ||s + p||^2 = ||s||^2 + 2 * s * p + ||p||^2
+        for (int i = 0; i < batchSize; ++i) {
+            Feature* p = localPoints[batchPoints[i]];
+            int c = batchAssignment[i];
+            double dot = dotVectors(p, centroidsSums[c]);
+            double norm = centroidsNorms[c] > 0 ? std::sqrt(centroidsNorms[c]) : 1;
+            windowCos += dot / norm;
+            centroidsNorms[c] += 2 * dot + squaredNorm(p);
+            addVector(p, centroidsSums[c]);
+        }
+        sampled += batchSize;
+
+        if (b % windowBatches == 0) {
+            oldCos = newCos;
+            newCos = windowCos / (windowBatches * batchSize);
+            windowCos = 0;
+            if (newCos - oldCos < eps) break;
+        }
+    }
+
+    // Final assignment of all the points using normalized centroids
+    for (int i = 0; i < centroids; ++i) unitNorm(centroidsSums[i]);
+
+    similarities.resize(points);
+    for (auto& s : similarities) s.values.resize(centroids);
+
+    int tRows = ceil(static_cast<double>(points) / threads);
+    if (threads > 1) {
+        ThreadSet tSet;
+        for (int t = 0; t < threads; ++t)
+            tSet.add(computeSimilaritiesThread, std::ref(similarities), std::ref(localPoints),
+                     std::ref(centroidsSums), std::min(t * tRows, points), std::min((t + 1) * tRows, points));
+        tSet.joinAll();
+    } else
+        computeSimilaritiesThread(similarities, localPoints, centroidsSums, 0, points);
+
+    int maxPartitionSize = balanced ? points / centroids : points;
+    int maxWithOneMore = balanced ? points % centroids : 0;
+    if (centroids == 2) {
+        if (balanced) {
+            std::nth_element(similarities.begin(), similarities.begin() + maxPartitionSize, similarities.end());
+            for (int i = 0; i < points; ++i)
+                (*partition)[similarities[i].index].value = (i < maxPartitionSize) ? 1 : 0;
+        } else
+            for (const auto& s : similarities) (*partition)[s.index].value = (s.sortby <= 0) ? 1 : 0;
+    } else {
+        std::vector<int> centroidsSizes(centroids, 0);
+        std::sort(similarities.rbegin(), similarities.rend());
+        for (const auto& s : similarities) {
+            for (const auto& v : s.values) {
+                if (centroidsSizes[v.index] < maxPartitionSize ||
+                    (centroidsSizes[v.index] < maxPartitionSize + 1 && maxWithOneMore > 0)) {
+                    if (centroidsSizes[v.index] == maxPartitionSize) --maxWithOneMore;
+                    (*partition)[s.index].value = v.index;
+                    ++centroidsSizes[v.index];
+                    break;
+                }
+            }
+        }
+    }
+}
@@ -21,6 +21,15 @@ struct Similarities {
     bool operator<(const Similarities& r) const { return sortby < r.sortby; }
 };
 
-// Partition is returned via reference, calculated for cosine distance
+// Minimal number of points per thread in parallel clustering of a single partition
+const int minPointsPerThread = 1000;
+
+// Partition is returned via reference, calculated for cosine distance,
+// large partitions are clustered using up to given number of threads, the result does not depend on it
 void kMeans(std::vector<Assignation>* partition, SRMatrix<Feature>& pointsFeatures, int centroids, double eps,
-            bool balanced, int seed);
+            bool balanced, int seed, int threads = 1);
+
+// Mini-batch version of K-Means for large partitions, centroids are updated using batches of randomly sampled points
+// and all the points are assigned to the final centroids
+void miniBatchKMeans(std::vector<Assignation>* partition, SRMatrix<Feature>& pointsFeatures, int centroids,
+                     double eps, bool balanced, int batchSize, int seed, int threads = 1);
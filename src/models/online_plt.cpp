@@ -37,8 +37,11 @@ void OnlinePLT::init(int labelCount, Args& args) {
 
 void OnlinePLT::update(const int row, Label* labels, size_t labelsSize, Feature* features, size_t featuresSize,
                        Args& args) {
-    UnorderedSet<TreeNode *> nPositive;
-    UnorderedSet<TreeNode *> nNegative;
+    // Buffers are reused between the updates made by the same thread
+    static thread_local TreeNodeSet nPositive;
+    static thread_local TreeNodeSet nNegative;
+    nPositive.clear();
+    nNegative.clear();
     
     if (onlineTree) { // Check if example contains a new label
         std::vector<int> newLabels;
@@ -70,19 +73,45 @@ void OnlinePLT::update(const int row, Label* labels, size_t labelsSize, Feature*
     else getNodesToUpdate(nPositive, nNegative, labels, labelsSize);
 
     // Update positive base estimators
-    for (const auto &n : nPositive) bases[n->index]->update(1.0, features, args);
+    for (const auto &n : nPositive) bases[n]->update(1.0, features, args);
 
     // Update negative
-    for (const auto &n : nNegative) bases[n->index]->update(0.0, features, args);
+    for (const auto &n : nNegative) bases[n]->update(0.0, features, args);
 
     // Update temporary nodes
     if (onlineTree)
         for (const auto &n : nPositive) {
-            if (tmpBases[n->index] != nullptr)
-                tmpBases[n->index]->update(0.0, features, args);
+            if (tmpBases[n] != nullptr)
+                tmpBases[n]->update(0.0, features, args);
         }
 }
 
+void OnlinePLT::getNodesToUpdate(TreeNodeSet& nPositive, TreeNodeSet& nNegative,
+                                 const int* rLabels, const int rSize) {
+    for (int i = 0; i < rSize; ++i) {
+        auto ni = tree->leaves.find(rLabels[i]);
+        if (ni == tree->leaves.end()) {
+            std::cerr << "Encountered example with label " << rLabels[i] << " that does not exists in the tree\n";
+            continue;
+        }
+        // Go up until reaching the node already marked by other label
+        TreeNode* n = ni->second;
+        while (n != nullptr && nPositive.insert(n->index)) n = n->parent;
+    }
+
+    if (!nPositive.count(tree->root->index)) {
+        nNegative.insert(tree->root->index);
+        return;
+    }
+
+    for (int i : nPositive) {
+        for (const auto& child : tree->nodes[i]->children) {
+            if (!nPositive.count(child->index))
+                nNegative.insert(child->index);
+        }
+    }
+}
+
 void OnlinePLT::save(Args& args, std::string output) {
 
     // Save base classifiers
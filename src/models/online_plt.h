@@ -30,4 +30,7 @@ protected:
 
     TreeNode* createTreeNode(TreeNode* parent = nullptr, int label = -1, Base* base = nullptr, Base* tmpBase = nullptr);
     void expandTree(const std::vector<Label>& newLabels, Feature* features, Args& args);
+
+    // Tree grows during the training, so unlike PLT it walks the tree nodes instead of the flattened tree
+    void getNodesToUpdate(TreeNodeSet& nPositive, TreeNodeSet& nNegative, const int* rLabels, const int rSize);
 };
@@ -36,6 +36,13 @@ void OVR::train(SRMatrix<Label>& labels, SRMatrix<Feature>& features, Args& args
     std::vector<Feature*> binFeatures;
     binFeatures.reserve(bRows);
 
+    // Squared norms of examples, shared by all the base estimators
+    std::vector<double>* binNorms = nullptr;
+    if (Base::requiresSquaredNorms(args)) {
+        binNorms = new std::vector<double>();
+        binNorms->reserve(bRows);
+    }
+
     for (int r = 0; r < rows; ++r) {
         int rSize = labels.size(r);
 
@@ -47,6 +54,11 @@ void OVR::train(SRMatrix<Label>& labels, SRMatrix<Feature>& features, Args& args
 
         for (int i = 0; i < rSize; ++i)
             binFeatures.push_back(features[r]);
+        if (binNorms != nullptr) {
+            double norm = squaredNorm(features[r]);
+            for (int i = 0; i < rSize; ++i)
+                binNorms->push_back(norm);
+        }
         if(args.pickOneLabelWeighting)
             for (int i = 0; i < rSize; ++i)
                 binWeights->push_back(1.0 / rSize);
@@ -89,17 +101,24 @@ void OVR::train(SRMatrix<Label>& labels, SRMatrix<Feature>& features, Args& args
         if(args.pickOneLabelWeighting)
             assert(binLabels[0].size() == binWeights->size());
 
-        trainBasesWithSameFeatures(out, features.cols(), binLabels, binFeatures, binWeights, args);
+        trainBasesWithSameFeatures(out, features.cols(), binLabels, binFeatures, binWeights, binNorms, args);
         for (auto& l : binLabels) l.clear();
     }
 
     out.close();
     delete binWeights;
+    delete binNorms;
 }
 
-std::vector<Prediction> OVR::predictForAllLabels(Feature* features, Args& args) {
-    std::vector<Prediction> prediction;
-    prediction.reserve(bases.size());
+void OVR::predictForAllLabels(std::vector<Prediction>& prediction, Feature* features,
+                              const PredictOptions& options) const {
+    if (!index.empty()) {
+        BR::predictForAllLabels(prediction, features, options);
+        return;
+    }
+
+    size_t first = prediction.size();
+    prediction.reserve(first + bases.size());
     double sum = 0;
 
     for (int i = 0; i < bases.size(); ++i) {
@@ -108,11 +127,19 @@ std::vector<Prediction> OVR::predictForAllLabels(Feature* features, Args& args)
         prediction.push_back({i, value});
     }
 
-    for (auto& p : prediction) p.value /= sum;
-    return prediction;
+    for (size_t i = first; i < prediction.size(); ++i) prediction[i].value /= sum;
 }
 
-double OVR::predictForLabel(Label label, Feature* features, Args& args) {
+double OVR::predictForLabel(Label label, Feature* features, const PredictOptions& options) const {
+    if (!index.empty()) {
+        PredictionContext& context = PredictionContext::local();
+        scoreTouchedLabels(features, context);
+        double value = context.isTouched[label] ? context.scores[label] : defaultValues[label];
+        value = labelValue(label, value, normalization(context));
+        InvertedIndex::clear(context.scores, context.isTouched, context.touched);
+        return value;
+    }
+
     double sum = 0;
     for (int i = 0; i < bases.size(); ++i) {
         double value = exp(bases[i]->predictValue(features)); // Softmax normalization
@@ -121,3 +148,19 @@ double OVR::predictForLabel(Label label, Feature* features, Args& args) {
 
     return exp(bases[label]->predictValue(features)) / sum;
 }
+
+void OVR::buildIndex() {
+    BR::buildIndex();
+    defaultExpSum = 0;
+    for (auto v : defaultValues) defaultExpSum += exp(v);
+}
+
+double OVR::normalization(PredictionContext& context) const {
+    // Untouched labels contribute with their default values
+    double untouchedSum = defaultExpSum, touchedSum = 0;
+    for (auto l : context.touched) {
+        untouchedSum -= exp(defaultValues[l]);
+        touchedSum += exp(context.scores[l]);
+    }
+    return std::max(untouchedSum, 0.0) + touchedSum;
+}
@@ -12,8 +12,16 @@ class OVR : public BR { // OVR is multi-class version of BR
 public:
     OVR();
     void train(SRMatrix<Label>& labels, SRMatrix<Feature>& features, Args& args, std::string output) override;
-    double predictForLabel(Label label, Feature* features, Args& args) override;
+    double predictForLabel(Label label, Feature* features, const PredictOptions& options) const override;
 
 protected:
-    std::vector<Prediction> predictForAllLabels(Feature* features, Args& args) override;
+    double defaultExpSum; // Softmax normalization for data points without any features
+
+    void predictForAllLabels(std::vector<Prediction>& prediction, Feature* features,
+                             const PredictOptions& options) const override;
+
+    void buildIndex() override;
+    double normalization(PredictionContext& context) const override;
+    inline double labelValue(int label, double value, double norm) const override { return exp(value) / norm; }
+    inline bool softmaxValues() const override { return true; }
 };
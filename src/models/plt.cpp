@@ -5,21 +5,21 @@
 
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <climits>
 #include <cmath>
 #include <list>
 #include <vector>
 
 #include "plt.h"
+#include "prediction_context.h"
+#include "threads.h"
 
 
 PLT::PLT() {
     tree = nullptr;
     treeSize = 0;
     treeDepth = 0;
-    nodeEvaluationCount = 0;
-    nodeUpdateCount = 0;
-    dataPointCount = 0;
     type = plt;
     name = "PLT";
 }
@@ -30,40 +30,113 @@ PLT::~PLT() {
 }
 
 void PLT::assignDataPoints(std::vector<std::vector<double>>& binLabels, std::vector<std::vector<Feature*>>& binFeatures,
-                           std::vector<std::vector<double>*>* binWeights, SRMatrix<Label>& labels,
+                           std::vector<std::vector<double>*>* binWeights,
+                           std::vector<std::vector<double>>* binNorms, SRMatrix<Label>& labels,
                            SRMatrix<Feature>& features, Args& args) {
 
-    std::cerr << "Assigning data points to nodes ...\n";
+    std::cerr << "Assigning data points to nodes in " << args.threads << " threads ...\n";
 
-    // Positive and negative nodes
-    UnorderedSet<TreeNode*> nPositive;
-    UnorderedSet<TreeNode*> nNegative;
-
-    // Gather examples for each node
+    // Each thread gathers examples of its range of rows for each node
     int rows = features.rows();
-    for (int r = 0; r < rows; ++r) {
-        printProgress(r, rows);
-
-        nPositive.clear();
-        nNegative.clear();
-
-        getNodesToUpdate(nPositive, nNegative, labels[r], labels.size(r));
-        addNodesLabelsAndFeatures(binLabels, binFeatures, nPositive, nNegative, features[r]);
+    std::vector<AssignedDataPoints> assigned(args.threads);
+    for (auto& a : assigned) {
+        a.binLabels.resize(tree->t);
+        a.binFeatures.resize(tree->t);
+        if (binWeights != nullptr) a.binWeights.resize(tree->t);
+        if (binNorms != nullptr) a.binNorms.resize(tree->t);
+        a.nodeUpdateCount = 0;
+        a.dataPointCount = 0;
+        a.pathLength = 0;
+    }
 
-        nodeUpdateCount += nPositive.size() + nNegative.size();
-        ++dataPointCount;
+    ThreadSet tSet;
+    int tRows = ceil(static_cast<double>(rows) / args.threads);
+    for (int t = 0; t < args.threads; ++t)
+        tSet.add(assignDataPointsThread, this, std::ref(assigned[t]), std::ref(labels), std::ref(features),
+                 std::ref(args), t, std::min(t * tRows, rows), std::min((t + 1) * tRows, rows));
+    tSet.joinAll();
+
+    // Concatenate threads' examples in row order, so the result does not depend on the number of threads
+    for (int t = 0; t < args.threads; ++t)
+        tSet.add(mergeDataPointsThread, std::ref(binLabels), std::ref(binFeatures), binWeights, binNorms,
+                 std::ref(assigned), t, args.threads);
+    tSet.joinAll();
+
+    MetricsCounters& counters = metrics.local();
+    unsigned long long nodeUpdateCount = 0;
+    for (const auto& a : assigned) {
+        nodeUpdateCount += a.nodeUpdateCount;
+        counters.dataPoints += a.dataPointCount;
+        counters.pathLength += a.pathLength;
     }
+    counters.nodeUpdates += nodeUpdateCount;
 
     unsigned long long usedMem = nodeUpdateCount * (sizeof(double) + sizeof(Feature*)) + binLabels.size() * (sizeof(binLabels) + sizeof(binFeatures));
+    if (binNorms != nullptr) usedMem += nodeUpdateCount * sizeof(double);
     std::cerr << "  Temporary data size: " << formatMem(usedMem) << std::endl;
 }
 
+void PLT::assignDataPoint(AssignedDataPoints& assigned, Label* rLabels, int rSize, Feature* rFeatures, Args& args) {
+    assigned.nPositive.clear();
+    assigned.nNegative.clear();
+
+    getNodesToUpdate(assigned.nPositive, assigned.nNegative, rLabels, rSize);
+    addNodesLabelsAndFeatures(assigned, rFeatures);
+
+    assigned.nodeUpdateCount += assigned.nPositive.size() + assigned.nNegative.size();
+    ++assigned.dataPointCount;
+}
+
+void PLT::assignDataPointsThread(PLT* model, AssignedDataPoints& assigned, SRMatrix<Label>& labels,
+                                 SRMatrix<Feature>& features, Args& args, int threadId, int startRow, int stopRow) {
+    const int rowsRange = stopRow - startRow;
+    for (int r = startRow; r < stopRow; ++r) {
+        if (!threadId) printProgress(r - startRow, rowsRange);
+        if (!assigned.binNorms.empty()) assigned.norm = squaredNorm(features[r]);
+        model->assignDataPoint(assigned, labels[r], labels.size(r), features[r], args);
+    }
+}
+
+void PLT::mergeDataPointsThread(std::vector<std::vector<double>>& binLabels,
+                                std::vector<std::vector<Feature*>>& binFeatures,
+                                std::vector<std::vector<double>*>* binWeights,
+                                std::vector<std::vector<double>>* binNorms,
+                                std::vector<AssignedDataPoints>& assigned, int threadId, int threads) {
+    int t = binLabels.size();
+    for (int n = threadId; n < t; n += threads) {
+        size_t size = 0;
+        for (const auto& a : assigned) size += a.binLabels[n].size();
+        binLabels[n].reserve(size);
+        binFeatures[n].reserve(size);
+        if (binWeights != nullptr) (*binWeights)[n]->reserve(size);
+        if (binNorms != nullptr) (*binNorms)[n].reserve(size);
+
+        for (auto& a : assigned) {
+            binLabels[n].insert(binLabels[n].end(), a.binLabels[n].begin(), a.binLabels[n].end());
+            binFeatures[n].insert(binFeatures[n].end(), a.binFeatures[n].begin(), a.binFeatures[n].end());
+            std::vector<double>().swap(a.binLabels[n]);
+            std::vector<Feature*>().swap(a.binFeatures[n]);
+
+            if (binWeights != nullptr) {
+                (*binWeights)[n]->insert((*binWeights)[n]->end(), a.binWeights[n].begin(), a.binWeights[n].end());
+                std::vector<double>().swap(a.binWeights[n]);
+            }
+
+            if (binNorms != nullptr) {
+                (*binNorms)[n].insert((*binNorms)[n].end(), a.binNorms[n].begin(), a.binNorms[n].end());
+                std::vector<double>().swap(a.binNorms[n]);
+            }
+        }
+    }
+}
+
 std::vector<std::vector<std::pair<int, int>>> PLT::assignDataPoints(SRMatrix<Label>& labels, SRMatrix<Feature>& features){
-    std::vector<std::vector<std::pair<int, int>>> nodesDataPoints;
+    std::vector<std::vector<std::pair<int, int>>> nodesDataPoints(tree->t);
+    flatTree = FlatTree(*tree);
 
     // Positive and negative nodes
-    UnorderedSet<TreeNode*> nPositive;
-    UnorderedSet<TreeNode*> nNegative;
+    TreeNodeSet nPositive;
+    TreeNodeSet nNegative;
 
     // Gather examples for each node
     int rows = features.rows();
@@ -80,89 +153,237 @@ std::vector<std::vector<std::pair<int, int>>> PLT::assignDataPoints(SRMatrix<Lab
     return nodesDataPoints;
 }
 
-void PLT::getNodesToUpdate(UnorderedSet<TreeNode*>& nPositive, UnorderedSet<TreeNode*>& nNegative,
+void PLT::getNodesToUpdate(TreeNodeSet& nPositive, TreeNodeSet& nNegative,
                            const int* rLabels, const int rSize) {
+    const FlatTree& ft = flatTree;
     for (int i = 0; i < rSize; ++i) {
-        auto ni = tree->leaves.find(rLabels[i]);
-        if (ni == tree->leaves.end()) {
+        int n = ft.leaf(rLabels[i]);
+        if (n == -1) {
             std::cerr << "Encountered example with label " << rLabels[i] << " that does not exists in the tree\n";
             continue;
         }
-        TreeNode* n = ni->second;
-        nPositive.insert(n);
-        while (n->parent) {
-            n = n->parent;
-            nPositive.insert(n);
-        }
+        // Go up until reaching the node already marked by other label
+        while (n != -1 && nPositive.insert(ft.index[n])) n = ft.parent[n];
     }
 
-    if (!nPositive.count(tree->root)) {
-        nNegative.insert(tree->root);
+    if (!nPositive.count(ft.index[ft.root()])) {
+        nNegative.insert(ft.index[ft.root()]);
         return;
     }
 
-    for(auto& n : nPositive) {
-        for (const auto &child : n->children) {
-            if (!nPositive.count(child))
-                nNegative.insert(child);
+    for (int i : nPositive) {
+        int n = ft.position[i];
+        for (int c = ft.childrenBegin(n); c < ft.childrenEnd(n); ++c) {
+            if (!nPositive.count(ft.index[c]))
+                nNegative.insert(ft.index[c]);
         }
     }
 }
 
-void PLT::addNodesLabelsAndFeatures(std::vector<std::vector<double>>& binLabels, std::vector<std::vector<Feature*>>& binFeatures,
-                      UnorderedSet<TreeNode*>& nPositive, UnorderedSet<TreeNode*>& nNegative,
-                      Feature* features) {
-    for (const auto& n : nPositive) {
-        binLabels[n->index].push_back(1.0);
-        binFeatures[n->index].push_back(features);
+void PLT::addNodesLabelsAndFeatures(AssignedDataPoints& assigned, Feature* features) {
+    for (const auto& n : assigned.nPositive) {
+        assigned.binLabels[n].push_back(1.0);
+        assigned.binFeatures[n].push_back(features);
     }
 
-    for (const auto& n : nNegative) {
-        binLabels[n->index].push_back(0.0);
-        binFeatures[n->index].push_back(features);
+    for (const auto& n : assigned.nNegative) {
+        assigned.binLabels[n].push_back(0.0);
+        assigned.binFeatures[n].push_back(features);
+    }
+
+    if (!assigned.binNorms.empty()) {
+        for (const auto& n : assigned.nPositive) assigned.binNorms[n].push_back(assigned.norm);
+        for (const auto& n : assigned.nNegative) assigned.binNorms[n].push_back(assigned.norm);
     }
 }
 
 void PLT::addNodesDataPoints(std::vector<std::vector<std::pair<int, int>>>& nodesDataPoints, int row,
-                             UnorderedSet<TreeNode*>& nPositive, UnorderedSet<TreeNode*>& nNegative) {
+                             TreeNodeSet& nPositive, TreeNodeSet& nNegative) {
     for (const auto& n : nPositive)
-        nodesDataPoints[n->index].push_back({row, 1.0});
+        nodesDataPoints[n].push_back({row, 1.0});
 
     for (const auto& n : nNegative)
-        nodesDataPoints[n->index].push_back({row, 1.0});
+        nodesDataPoints[n].push_back({row, 1.0});
 }
 
-void PLT::predict(std::vector<Prediction>& prediction, Feature* features, Args& args) {
-    TopKQueue<TreeNodeValue> nQueue(args.topK);
-    //TopKQueue<TreeNodeValue> nQueue(0);
+void PLT::predict(std::vector<Prediction>& prediction, Feature* features, const PredictOptions& options) const {
+    if (options.beam > 0) {
+        predictBeam(prediction, features, options);
+        return;
+    }
+
+    TopKQueue<FlatNodeValue>& nQueue = PredictionContext::local().nQueue;
+    nQueue.reset(options.topK);
 
-    nQueue.push({tree->root, predictForNode(tree->root, features)});
-    ++nodeEvaluationCount;
-    ++dataPointCount;
+    MetricsCounters& counters = metrics.local();
+    uint64_t startEvaluations = counters.nodeEvaluations;
+    size_t maxQueueSize = 1;
 
-    Prediction p = predictNextLabel(nQueue, features, args.threshold);
-    while ((prediction.size() < args.topK || args.topK == 0) && p.label != -1) {
+    nQueue.push({flatTree.root(), predictForNode(flatTree.root(), features)});
+    ++counters.nodeEvaluations;
+    ++counters.dataPoints;
+
+    Prediction p = predictNextLabel(nQueue, features, options.threshold);
+    while ((prediction.size() < options.topK || options.topK == 0) && p.label != -1) {
         prediction.push_back(p);
-        p = predictNextLabel(nQueue, features, args.threshold);
+        maxQueueSize = std::max(maxQueueSize, nQueue.size());
+        p = predictNextLabel(nQueue, features, options.threshold);
     }
+
+    counters.nodesPerDataPoint.add(counters.nodeEvaluations - startEvaluations);
+    counters.queueSize.add(std::max(maxQueueSize, nQueue.size()));
 }
 
-Prediction PLT::predictNextLabel(TopKQueue<TreeNodeValue>& nQueue, Feature* features, double threshold) {
+Prediction PLT::predictNextLabel(TopKQueue<FlatNodeValue>& nQueue, Feature* features, double threshold) const {
     while (!nQueue.empty()) {
-        TreeNodeValue nVal = nQueue.top();
+        FlatNodeValue nVal = nQueue.top();
         nQueue.pop();
 
-        if (!nVal.node->children.empty()) {
-            for (const auto& child : nVal.node->children)
-                addToQueue(nQueue, child, nVal.value * predictForNode(child, features), threshold);
-            nodeEvaluationCount += nVal.node->children.size();
-        }
-        if (nVal.node->label >= 0) return {nVal.node->label, nVal.value};
+        int cBegin = flatTree.childrenBegin(nVal.node), cEnd = flatTree.childrenEnd(nVal.node);
+        for (int c = cBegin; c < cEnd; ++c)
+            addToQueue(nQueue, c, nVal.value * predictForNode(c, features), threshold);
+        metrics.local().nodeEvaluations += cEnd - cBegin;
+
+        if (flatTree.label[nVal.node] >= 0) return {flatTree.label[nVal.node], nVal.value};
     }
 
     return {-1, 0};
 }
 
+// Number of examples predicted together by node-major prediction
+const int predictionBlockSize = 256;
+
+// Expansion of the node for the example of the block
+struct NodeExpansion {
+    int node;
+    int example;
+    double value;
+};
+
+std::vector<std::vector<Prediction>> PLT::predictBatch(SRMatrix<Feature>& features,
+                                                       const PredictOptions& options) const {
+    if (options.beam > 0) return Model::predictBatch(features, options);
+
+    std::cerr << "Starting node-major prediction in " << options.threads << " threads ...\n";
+
+    int rows = features.rows();
+    std::vector<std::vector<Prediction>> predictions(rows);
+    processRowsInChunks(rows, predictionBlockSize, options.threads, [&](int start, int stop) {
+        predictBlock(predictions, features, options, start, stop);
+    });
+
+    return predictions;
+}
+
+void PLT::predictBlock(std::vector<std::vector<Prediction>>& predictions, SRMatrix<Feature>& features,
+                       const PredictOptions& options, int startRow, int stopRow) const {
+    auto startTime = std::chrono::steady_clock::now();
+    int size = stopRow - startRow;
+    std::vector<TopKQueue<FlatNodeValue>> nQueues(size, TopKQueue<FlatNodeValue>(options.topK));
+    std::vector<int> active(size);
+    std::vector<uint64_t> nodesEvaluations(size, 1);
+    std::vector<size_t> maxQueueSizes(size, 1);
+
+    int root = flatTree.root();
+    for (int i = 0; i < size; ++i) {
+        nQueues[i].push({root, predictForNode(root, features[startRow + i])});
+        active[i] = i;
+    }
+    MetricsCounters& counters = metrics.local();
+    counters.nodeEvaluations += size;
+    counters.dataPoints += size;
+
+    std::vector<NodeExpansion> expansions;
+    std::vector<FlatNodeValue> children;
+    while (!active.empty()) {
+        // Each active example takes the next node from its queue, in the same way as predictNextLabel
+        expansions.clear();
+        for (int i : active) {
+            FlatNodeValue nVal = nQueues[i].top();
+            nQueues[i].pop();
+            expansions.push_back({nVal.node, i, nVal.value});
+        }
+
+        // Group the examples by the expanded node
+        std::sort(expansions.begin(), expansions.end(), [](const NodeExpansion& a, const NodeExpansion& b) {
+            return a.node < b.node || (a.node == b.node && a.example < b.example);
+        });
+
+        for (const auto& e : expansions) {
+            children.clear();
+            predictChildren(children, e.node, e.value, features[startRow + e.example]);
+            for (const auto& c : children) addToQueue(nQueues[e.example], c.node, c.value, options.threshold);
+            nodesEvaluations[e.example] += children.size();
+            maxQueueSizes[e.example] = std::max(maxQueueSizes[e.example], nQueues[e.example].size());
+            if (flatTree.label[e.node] >= 0) predictions[startRow + e.example].push_back({flatTree.label[e.node], e.value});
+        }
+
+        // Remove examples with complete predictions
+        active.erase(std::remove_if(active.begin(), active.end(), [&](int i) {
+            return (options.topK > 0 && predictions[startRow + i].size() >= options.topK) || nQueues[i].empty();
+        }), active.end());
+    }
+
+    // Examples of the block are predicted together, so each of them gets the average latency of the block
+    uint64_t latency = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - startTime).count() / size;
+    for (int i = 0; i < size; ++i) {
+        counters.latency.add(latency);
+        counters.nodesPerDataPoint.add(nodesEvaluations[i]);
+        counters.queueSize.add(maxQueueSizes[i]);
+    }
+}
+
+void PLT::predictBeam(std::vector<Prediction>& prediction, Feature* features, const PredictOptions& options) const {
+    PredictionContext& context = PredictionContext::local();
+    std::vector<FlatNodeValue>& beam = context.beam;
+    std::vector<FlatNodeValue>& nextBeam = context.nextBeam;
+    std::vector<Prediction>& leaves = context.predictions;
+    beam.clear();
+    leaves.clear();
+
+    MetricsCounters& counters = metrics.local();
+    uint64_t startEvaluations = counters.nodeEvaluations;
+
+    // Root is checked against the threshold like all the other nodes
+    double rootValue = predictForNode(flatTree.root(), features);
+    if (rootValue >= options.threshold) beam.push_back({flatTree.root(), rootValue});
+    ++counters.nodeEvaluations;
+    ++counters.dataPoints;
+
+    while (!beam.empty()) {
+        // Evaluate children of all the nodes in the beam
+        nextBeam.clear();
+        for (const auto& nVal : beam) {
+            if (flatTree.label[nVal.node] >= 0) leaves.push_back({flatTree.label[nVal.node], nVal.value});
+            predictChildren(nextBeam, nVal.node, nVal.value, features);
+        }
+
+        // Keep only the best nodes above the threshold
+        nextBeam.erase(std::remove_if(nextBeam.begin(), nextBeam.end(),
+                                      [&](const FlatNodeValue& n) { return n.value < options.threshold; }),
+                       nextBeam.end());
+        if (nextBeam.size() > options.beam) {
+            std::nth_element(nextBeam.begin(), nextBeam.begin() + options.beam, nextBeam.end(),
+                             std::greater<FlatNodeValue>());
+            nextBeam.erase(nextBeam.begin() + options.beam, nextBeam.end());
+        }
+        beam.swap(nextBeam);
+    }
+
+    int k = options.topK > 0 ? std::min<int>(options.topK, leaves.size()) : leaves.size();
+    std::partial_sort(leaves.begin(), leaves.begin() + k, leaves.end(),
+                      [](const Prediction& a, const Prediction& b) { return a.value > b.value; });
+    prediction.insert(prediction.end(), leaves.begin(), leaves.begin() + k);
+    counters.nodesPerDataPoint.add(counters.nodeEvaluations - startEvaluations);
+}
+
+void PLT::predictChildren(std::vector<FlatNodeValue>& nValues, int node, double value, Feature* features) const {
+    int cBegin = flatTree.childrenBegin(node), cEnd = flatTree.childrenEnd(node);
+    for (int c = cBegin; c < cEnd; ++c) nValues.push_back({c, value * predictForNode(c, features)});
+    metrics.local().nodeEvaluations += cEnd - cBegin;
+}
+
 void PLT::setThresholds(std::vector<double> th){
     thresholds = th;
 
@@ -180,6 +401,8 @@ void PLT::setThresholds(std::vector<double> th){
 
     tree->root->th = 0;
     tree->root->thLabel = 0;
+
+    flatTree.updateThresholds(*tree);
 }
 
 void PLT::updateThresholds(UnorderedMap<int, double> thToUpdate){
@@ -200,54 +423,93 @@ void PLT::updateThresholds(UnorderedMap<int, double> thToUpdate){
                     }
                 }
             }
+            flatTree.th[flatTree.position[n->index]] = n->th;
             n = n->parent;
         }
     }
 }
 
-void PLT::predictWithThresholds(std::vector<Prediction>& prediction, Feature* features, Args& args) {
-    TopKQueue<TreeNodeValue> nQueue;
+void PLT::predictWithThresholds(std::vector<Prediction>& prediction, Feature* features,
+                                const PredictOptions& options) const {
+    TopKQueue<FlatNodeValue>& nQueue = PredictionContext::local().nQueue;
+    nQueue.reset(0);
+
+    MetricsCounters& counters = metrics.local();
+    uint64_t startEvaluations = counters.nodeEvaluations;
+    size_t maxQueueSize = 1;
 
-    nQueue.push({tree->root, predictForNode(tree->root, features)});
-    ++nodeEvaluationCount;
-    ++dataPointCount;
+    nQueue.push({flatTree.root(), predictForNode(flatTree.root(), features)});
+    ++counters.nodeEvaluations;
+    ++counters.dataPoints;
 
     Prediction p = predictNextLabelWithThresholds(nQueue, features);
     while (p.label != -1) {
         prediction.push_back(p);
+        maxQueueSize = std::max(maxQueueSize, nQueue.size());
         p = predictNextLabelWithThresholds(nQueue, features);
     }
+
+    counters.nodesPerDataPoint.add(counters.nodeEvaluations - startEvaluations);
+    counters.queueSize.add(maxQueueSize);
 }
 
-Prediction PLT::predictNextLabelWithThresholds(TopKQueue<TreeNodeValue>& nQueue, Feature* features) {
+Prediction PLT::predictNextLabelWithThresholds(TopKQueue<FlatNodeValue>& nQueue, Feature* features) const {
     while (!nQueue.empty()) {
-        TreeNodeValue nVal = nQueue.top();
+        FlatNodeValue nVal = nQueue.top();
         nQueue.pop();
 
-        if (!nVal.node->children.empty()) {
-            for (const auto& child : nVal.node->children)
-                addToQueueThresholds(nQueue, child, nVal.value * predictForNode(child, features));
-            nodeEvaluationCount += nVal.node->children.size();
-        }
-        if (nVal.node->label >= 0) return {nVal.node->label, nVal.value};
+        int cBegin = flatTree.childrenBegin(nVal.node), cEnd = flatTree.childrenEnd(nVal.node);
+        for (int c = cBegin; c < cEnd; ++c)
+            addToQueueThresholds(nQueue, c, nVal.value * predictForNode(c, features));
+        metrics.local().nodeEvaluations += cEnd - cBegin;
+
+        if (flatTree.label[nVal.node] >= 0) return {flatTree.label[nVal.node], nVal.value};
     }
 
     return {-1, 0};
 }
 
-double PLT::predictForLabel(Label label, Feature* features, Args& args) {
-    auto fn = tree->leaves.find(label);
-    if(fn == tree->leaves.end()) return 0;
-    TreeNode* n = fn->second;
-    double value = bases[n->index]->predictProbability(features);
-    while (n->parent) {
-        n = n->parent;
+double PLT::predictForLabel(Label label, Feature* features, const PredictOptions& options) const {
+    int n = flatTree.leaf(label);
+    if (n == -1) return 0;
+    double value = predictForNode(n, features);
+    while (flatTree.parent[n] != -1) {
+        n = flatTree.parent[n];
         value *= predictForNode(n, features);
-        ++nodeEvaluationCount;
+        ++metrics.local().nodeEvaluations;
     }
     return value;
 }
 
+void PLT::predictForLabels(std::vector<double>& values, const std::vector<Label>& labels, Feature* features,
+                           const PredictOptions& options) const {
+    // Nodes shared by the labels' paths are evaluated only once
+    UnorderedMap<int, double> nodesValues;
+    auto nodeValue = [&](int n) {
+        auto nV = nodesValues.find(n);
+        if (nV != nodesValues.end()) return nV->second;
+        double value = predictForNode(n, features);
+        ++metrics.local().nodeEvaluations;
+        nodesValues.insert({n, value});
+        return value;
+    };
+
+    values.resize(labels.size());
+    for (size_t i = 0; i < labels.size(); ++i) {
+        int n = flatTree.leaf(labels[i]);
+        if (n == -1) {
+            values[i] = 0;
+            continue;
+        }
+        double value = nodeValue(n);
+        while (flatTree.parent[n] != -1) {
+            n = flatTree.parent[n];
+            value *= nodeValue(n);
+        }
+        values[i] = value;
+    }
+}
+
 void PLT::load(Args& args, std::string infile) {
     std::cerr << "Loading " << name << " model ...\n";
 
@@ -256,6 +518,7 @@ void PLT::load(Args& args, std::string infile) {
     bases = loadBases(joinPath(infile, "weights.bin"));
     assert(bases.size() == tree->nodes.size());
     m = tree->getNumberOfLeaves();
+    flatTree = FlatTree(*tree);
 
     if(!args.thresholds.empty())
         tree->populateNodeLabels();
@@ -265,20 +528,41 @@ void PLT::printInfo() {
     std::cout << name << " additional stats:"
               << "\n  Tree size: " << (tree != nullptr ? tree->nodes.size() : treeSize)
               << "\n  Tree depth: " << (tree != nullptr ? tree->getTreeDepth() : treeDepth) << "\n";
-    if(nodeUpdateCount > 0)
-        std::cout << "  Updated estimators / data point: " << static_cast<double>(nodeUpdateCount) / dataPointCount << "\n";
-    if(nodeEvaluationCount > 0)
-        std::cout << "  Evaluated estimators / data point: " << static_cast<double>(nodeEvaluationCount) / dataPointCount << "\n";
+    MetricsCounters counters = metrics.merged();
+    if(counters.nodeUpdates > 0)
+        std::cout << "  Updated estimators / data point: " << static_cast<double>(counters.nodeUpdates) / counters.dataPoints << "\n";
+    if(counters.nodeEvaluations > 0)
+        std::cout << "  Evaluated estimators / data point: " << static_cast<double>(counters.nodeEvaluations) / counters.dataPoints << "\n";
+    if(counters.pathLength > 0)
+        std::cout << "  Path length: " << static_cast<double>(counters.pathLength) / counters.dataPoints << "\n";
+    Model::printInfo();
 }
 
 void BatchPLT::train(SRMatrix<Label>& labels, SRMatrix<Feature>& features, Args& args, std::string output) {
+    std::vector<std::vector<double>> binLabels;
+    std::vector<std::vector<Feature*>> binFeatures;
+    std::vector<std::vector<double>*>* binWeights = nullptr;
+    std::vector<std::vector<double>>* binNorms = nullptr;
+
+    prepareTraining(binLabels, binFeatures, binWeights, binNorms, labels, features, args, output);
+    trainBases(joinPath(output, "weights.bin"), features.cols(), binLabels, binFeatures, binWeights, binNorms, args);
+    freeTrainingData(binWeights, binNorms);
+}
+
+void BatchPLT::prepareTraining(std::vector<std::vector<double>>& binLabels,
+                               std::vector<std::vector<Feature*>>& binFeatures,
+                               std::vector<std::vector<double>*>*& binWeights,
+                               std::vector<std::vector<double>>*& binNorms, SRMatrix<Label>& labels,
+                               SRMatrix<Feature>& features, Args& args, std::string output,
+                               SRMatrix<Feature>* labelsFeatures) {
 
     // Create tree
     if (!tree) {
         tree = new Tree();
-        tree->buildTreeStructure(labels, features, args);
+        tree->buildTreeStructure(labels, features, args, labelsFeatures);
     }
     m = tree->getNumberOfLeaves();
+    flatTree = FlatTree(*tree);
 
     std::cerr << "Training tree ...\n";
 
@@ -287,16 +571,18 @@ void BatchPLT::train(SRMatrix<Label>& labels, SRMatrix<Feature>& features, Args&
     //assert(tree->k >= labels.cols());
 
     // Examples selected for each node
-    std::vector<std::vector<double>> binLabels(tree->t);
-    std::vector<std::vector<Feature*>> binFeatures(tree->t);
-    std::vector<std::vector<double>*>* binWeights = nullptr;
+    binLabels.resize(tree->t);
+    binFeatures.resize(tree->t);
 
     if (type == hsm && args.pickOneLabelWeighting) {
         binWeights = new std::vector<std::vector<double>*>(tree->t);
         for (auto& p : *binWeights) p = new std::vector<double>();
     }
 
-    assignDataPoints(binLabels, binFeatures, binWeights, labels, features, args);
+    // Squared norms of examples selected for each node, used by dual solvers
+    if (Base::requiresSquaredNorms(args)) binNorms = new std::vector<std::vector<double>>(tree->t);
+
+    assignDataPoints(binLabels, binFeatures, binWeights, binNorms, labels, features, args);
 
     // Save tree and free it, it is no longer needed
     tree->saveToFile(joinPath(output, "tree.bin"));
@@ -305,10 +591,13 @@ void BatchPLT::train(SRMatrix<Label>& labels, SRMatrix<Feature>& features, Args&
     treeDepth = tree->getTreeDepth();
     delete tree;
     tree = nullptr;
+    flatTree = FlatTree();
+}
 
-    trainBases(joinPath(output, "weights.bin"), features.cols(), binLabels, binFeatures, binWeights, args);
-
-    if (type == hsm && args.pickOneLabelWeighting) {
+void BatchPLT::freeTrainingData(std::vector<std::vector<double>*>* binWeights,
+                                std::vector<std::vector<double>>* binNorms) {
+    delete binNorms;
+    if (binWeights != nullptr) {
         for (auto& w : *binWeights) delete w;
         delete binWeights;
     }
@@ -10,18 +10,40 @@
 #include "tree.h"
 
 
+// Data points assigned to the tree nodes by a single thread
+struct AssignedDataPoints {
+    std::vector<std::vector<double>> binLabels;
+    std::vector<std::vector<Feature*>> binFeatures;
+    std::vector<std::vector<double>> binWeights;
+    std::vector<std::vector<double>> binNorms;
+
+    // Positive and negative nodes and squared norm of the current data point
+    TreeNodeSet nPositive;
+    TreeNodeSet nNegative;
+    double norm;
+
+    int nodeUpdateCount;
+    int dataPointCount;
+    int pathLength;
+};
+
 // This is virtual class for all PLT based models: HSM, Batch PLT, Online PLT
 class PLT : virtual public Model {
 public:
     PLT();
     ~PLT() override;
 
-    void predict(std::vector<Prediction>& prediction, Feature* features, Args& args) override;
-    double predictForLabel(Label label, Feature* features, Args& args) override;
+    void predict(std::vector<Prediction>& prediction, Feature* features, const PredictOptions& options) const override;
+    double predictForLabel(Label label, Feature* features, const PredictOptions& options) const override;
+    void predictForLabels(std::vector<double>& values, const std::vector<Label>& labels, Feature* features,
+                          const PredictOptions& options) const override;
+    std::vector<std::vector<Prediction>> predictBatch(SRMatrix<Feature>& features,
+                                                      const PredictOptions& options) const override;
 
     void setThresholds(std::vector<double> th) override;
     void updateThresholds(UnorderedMap<int, double> thToUpdate) override;
-    void predictWithThresholds(std::vector<Prediction>& prediction, Feature* features, Args& args) override;
+    void predictWithThresholds(std::vector<Prediction>& prediction, Feature* features,
+                               const PredictOptions& options) const override;
 
     void load(Args& args, std::string infile) override;
 
@@ -32,46 +54,74 @@ public:
 
 protected:
     Tree* tree;
+    FlatTree flatTree; // Flattened tree used for prediction and gathering nodes to update
     std::vector<Base*> bases;
 
-    virtual void assignDataPoints(std::vector<std::vector<double>>& binLabels,
-                                  std::vector<std::vector<Feature*>>& binFeatures,
-                                  std::vector<std::vector<double>*>* binWeights, SRMatrix<Label>& labels,
-                                  SRMatrix<Feature>& features, Args& args);
-    void getNodesToUpdate(UnorderedSet<TreeNode*>& nPositive, UnorderedSet<TreeNode*>& nNegative,
+    void assignDataPoints(std::vector<std::vector<double>>& binLabels,
+                                std::vector<std::vector<Feature*>>& binFeatures,
+                                std::vector<std::vector<double>*>* binWeights,
+                                std::vector<std::vector<double>>* binNorms, SRMatrix<Label>& labels,
+                                SRMatrix<Feature>& features, Args& args);
+    virtual void assignDataPoint(AssignedDataPoints& assigned, Label* rLabels, int rSize, Feature* rFeatures,
+                                 Args& args);
+    static void assignDataPointsThread(PLT* model, AssignedDataPoints& assigned, SRMatrix<Label>& labels,
+                                       SRMatrix<Feature>& features, Args& args, int threadId, int startRow,
+                                       int stopRow);
+    static void mergeDataPointsThread(std::vector<std::vector<double>>& binLabels,
+                                      std::vector<std::vector<Feature*>>& binFeatures,
+                                      std::vector<std::vector<double>*>* binWeights,
+                                      std::vector<std::vector<double>>* binNorms,
+                                      std::vector<AssignedDataPoints>& assigned, int threadId, int threads);
+    void getNodesToUpdate(TreeNodeSet& nPositive, TreeNodeSet& nNegative,
                           const int* rLabels, const int rSize);
 
-    static void addNodesLabelsAndFeatures(std::vector<std::vector<double>>& binLabels, std::vector<std::vector<Feature*>>& binFeatures,
-                                   UnorderedSet<TreeNode*>& nPositive, UnorderedSet<TreeNode*>& nNegative, Feature* features);
+    static void addNodesLabelsAndFeatures(AssignedDataPoints& assigned, Feature* features);
     static void addNodesDataPoints(std::vector<std::vector<std::pair<int, int>>>& nodesDataPoints, int row,
-                                   UnorderedSet<TreeNode*>& nPositive, UnorderedSet<TreeNode*>& nNegative);
+                                   TreeNodeSet& nPositive, TreeNodeSet& nNegative);
 
     // Helper methods for prediction
-    virtual Prediction predictNextLabel(TopKQueue<TreeNodeValue>& nQueue, Feature* features, double threshold);
-    virtual Prediction predictNextLabelWithThresholds(TopKQueue<TreeNodeValue>& nQueue, Feature* features);
-
-    virtual inline double predictForNode(TreeNode* node, Feature* features){
-        return bases[node->index]->predictProbability(features);
+    virtual Prediction predictNextLabel(TopKQueue<FlatNodeValue>& nQueue, Feature* features, double threshold) const;
+    virtual Prediction predictNextLabelWithThresholds(TopKQueue<FlatNodeValue>& nQueue, Feature* features) const;
+
+    // Node-major prediction of blocks of examples, searches of all the examples in the block advance together
+    // and the examples expanding the same node are evaluated one after another, while node's weights are in cache.
+    // Results are the same as of predict
+    void predictBlock(std::vector<std::vector<Prediction>>& predictions, SRMatrix<Feature>& features,
+                      const PredictOptions& options, int startRow, int stopRow) const;
+
+    // Level-synchronous beam search, each level of the beam is expanded at once
+    void predictBeam(std::vector<Prediction>& prediction, Feature* features, const PredictOptions& options) const;
+    virtual void predictChildren(std::vector<FlatNodeValue>& nValues, int node, double value,
+                                 Feature* features) const;
+
+    // Nodes are given by their position in the flattened tree
+    virtual inline double predictForNode(int node, Feature* features) const {
+        return bases[flatTree.index[node]]->predictProbability(features);
     }
 
-    inline static void addToQueue(TopKQueue<TreeNodeValue>& nQueue, TreeNode* node, double value,
-                                  double threshold) {
-        if (value >= threshold) nQueue.push({node, value}, node->label > -1);
+    inline void addToQueue(TopKQueue<FlatNodeValue>& nQueue, int node, double value, double threshold) const {
+        if (value >= threshold) nQueue.push({node, value}, flatTree.label[node] > -1);
     }
 
-    inline static void addToQueueThresholds(TopKQueue<TreeNodeValue>& nQueue, TreeNode* node, double value) {
-        if (value >= node->th) nQueue.push({node, value}, node->label > -1);
+    inline void addToQueueThresholds(TopKQueue<FlatNodeValue>& nQueue, int node, double value) const {
+        if (value >= flatTree.th[node]) nQueue.push({node, value}, flatTree.label[node] > -1);
     }
 
     // Additional statistics
     int treeSize;
     int treeDepth;
-    int nodeEvaluationCount; // Number of visited nodes during training prediction (updated/evaluated classifiers)
-    int nodeUpdateCount; // Number of visited nodes during training or prediction
-    int dataPointCount; // Data points count
 };
 
 class BatchPLT : public PLT {
 public:
     void train(SRMatrix<Label>& labels, SRMatrix<Feature>& features, Args& args, std::string output) override;
+
+    // Builds and saves the tree and assigns data points to the nodes, bases are not trained,
+    // so the ensemble can train bases of all its members together
+    void prepareTraining(std::vector<std::vector<double>>& binLabels, std::vector<std::vector<Feature*>>& binFeatures,
+                         std::vector<std::vector<double>*>*& binWeights, std::vector<std::vector<double>>*& binNorms,
+                         SRMatrix<Label>& labels, SRMatrix<Feature>& features, Args& args, std::string output,
+                         SRMatrix<Feature>* labelsFeatures = nullptr);
+    static void freeTrainingData(std::vector<std::vector<double>*>* binWeights,
+                                 std::vector<std::vector<double>>* binNorms);
 };
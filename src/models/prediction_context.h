@@ -0,0 +1,62 @@
+/**
+ * Copyright (c) 2020 by Marek Wydmuch
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "args.h"
+#include "set_utility.h"
+#include "tree.h"
+#include "types.h"
+
+// Buffers reused by all the predictions made in one thread, so steady-state prediction does not allocate memory
+class PredictionContext {
+public:
+    TopKQueue<FlatNodeValue> nQueue; // Queue of the tree's nodes
+    std::vector<FlatNodeValue> beam; // Levels of beam search
+    std::vector<FlatNodeValue> nextBeam;
+    std::vector<double> values; // Values of the node's children
+    std::vector<Feature> hidden; // Hidden representation of extremeText
+    std::vector<Prediction> predictions; // Predictions for all the labels
+    std::vector<double> scores; // Scores of the labels accumulated using inverted index
+    std::vector<char> isTouched;
+    std::vector<int> touched; // Labels with non-zero weights for the data point's features
+    std::vector<double> blockScores; // Scores of the block of data points for the tile of labels
+    std::vector<double> blockSums;
+    UnorderedSet<int> seenLabels; // Labels already predicted by UBOP-MIPS
+
+    // Set utility is created again only if its parameters change
+    inline SetUtility& getSetUtility(const PredictOptions& options, int outputSize) {
+        if (!utility || utilityType != options.setUtilityType || utilityOutputSize != outputSize ||
+            utilityAlpha != options.alpha || utilityBeta != options.beta || utilityDelta != options.delta ||
+            utilityGamma != options.gamma) {
+            utility = SetUtility::factory(options, outputSize);
+            utilityType = options.setUtilityType;
+            utilityOutputSize = outputSize;
+            utilityAlpha = options.alpha;
+            utilityBeta = options.beta;
+            utilityDelta = options.delta;
+            utilityGamma = options.gamma;
+        }
+        return *utility;
+    }
+
+    // Context of the calling thread
+    static inline PredictionContext& local() {
+        static thread_local PredictionContext context;
+        return context;
+    }
+
+private:
+    std::shared_ptr<SetUtility> utility;
+    SetUtilityType utilityType;
+    int utilityOutputSize = 0;
+    double utilityAlpha = 0;
+    double utilityBeta = 0;
+    double utilityDelta = 0;
+    double utilityGamma = 0;
+};
@@ -44,7 +44,8 @@ void Tree::buildTreeStructure(int labelCount, Args& args) {
         throw std::invalid_argument("Unknown tree type");
 }
 
-void Tree::buildTreeStructure(SRMatrix<Label>& labels, SRMatrix<Feature>& features, Args& args) {
+void Tree::buildTreeStructure(SRMatrix<Label>& labels, SRMatrix<Feature>& features, Args& args,
+                              SRMatrix<Feature>* labelsFeatures) {
     // Load tree structure from file
     if (!args.treeStructure.empty()) loadTreeStructure(args.treeStructure);
 
@@ -62,11 +63,21 @@ void Tree::buildTreeStructure(SRMatrix<Label>& labels, SRMatrix<Feature>& featur
     else if (args.treeType == huffman)
         buildHuffmanTree(labels, args);
     else if (args.treeType == hierarchicalKMeans) {
-        SRMatrix<Feature> labelsFeatures;
-        computeLabelsFeaturesMatrix(labelsFeatures, labels, features, args.threads, args.norm,
-                                    args.kMeansWeightedFeatures);
-        //labelsFeatures.dump(joinPath(args.output, "lf_mat.txt"));
-        buildKMeansTree(labelsFeatures, args);
+        SRMatrix<Feature> computedLabelsFeatures;
+        if (labelsFeatures == nullptr) {
+            computeLabelsFeaturesMatrix(computedLabelsFeatures, labels, features, args.threads, args.norm,
+                                        args.kMeansWeightedFeatures);
+            labelsFeatures = &computedLabelsFeatures;
+        }
+        //labelsFeatures->dump(joinPath(args.output, "lf_mat.txt"));
+        if (args.kMeansProjection > 0) {
+            SRMatrix<Feature> projectedLabelsFeatures;
+            computeRandomProjection(projectedLabelsFeatures, *labelsFeatures, args.kMeansProjection, args.getSeed(),
+                                    args.threads, args.norm);
+            computedLabelsFeatures.clear();
+            buildKMeansTree(projectedLabelsFeatures, args);
+        } else
+            buildKMeansTree(*labelsFeatures, args);
     } else if (args.treeType == onlineKAryComplete || args.treeType == onlineKAryRandom)
         buildOnlineTree(labels, features, args);
     else if (args.treeType < custom)
@@ -81,8 +92,12 @@ void Tree::buildTreeStructure(SRMatrix<Label>& labels, SRMatrix<Feature>& featur
 }
 
 TreeNodePartition Tree::buildKMeansTreeThread(TreeNodePartition nPart, SRMatrix<Feature>& labelsFeatures, Args& args,
-                                              int seed) {
-    kMeans(nPart.partition, labelsFeatures, args.arity, args.kMeansEps, args.kMeansBalanced, seed);
+                                              int seed, int threads, bool miniBatch) {
+    if (miniBatch)
+        miniBatchKMeans(nPart.partition, labelsFeatures, args.arity, args.kMeansEps, args.kMeansBalanced,
+                        args.kMeansMiniBatch, seed, threads);
+    else
+        kMeans(nPart.partition, labelsFeatures, args.arity, args.kMeansEps, args.kMeansBalanced, seed, threads);
     return nPart;
 }
 
@@ -99,13 +114,23 @@ void Tree::buildKMeansTree(SRMatrix<Feature>& labelsFeatures, Args& args) {
     auto partition = new std::vector<Assignation>(k);
     for (int i = 0; i < k; ++i) (*partition)[i].index = i;
 
-    // Run clustering in parallel
+    // Run clustering in parallel, partitions of the top levels are large and few,
+    // so each of them also gets a share of threads proportional to its size
     ThreadPool tPool(args.threads);
     std::vector<std::future<TreeNodePartition>> results;
+    auto partitionThreads = [&](std::vector<Assignation>* p) {
+        return std::max(1, static_cast<int>(static_cast<long long>(args.threads) * p->size() / k));
+    };
+    // Mini-batch K-Means is used for the top levels, if partition is larger than the batch
+    auto partitionMiniBatch = [&](TreeNode* n, std::vector<Assignation>* p) {
+        return args.kMeansMiniBatch > 0 && p->size() > args.kMeansMiniBatch
+               && getNodeDepth(n) <= args.kMeansMiniBatchDepth;
+    };
 
     TreeNodePartition rootPart = {root, partition};
-    results.emplace_back(
-        tPool.enqueue(buildKMeansTreeThread, rootPart, std::ref(labelsFeatures), std::ref(args), kMeansSeeder(rng)));
+    results.emplace_back(tPool.enqueue(buildKMeansTreeThread, rootPart, std::ref(labelsFeatures), std::ref(args),
+                                       kMeansSeeder(rng), partitionThreads(partition),
+                                       partitionMiniBatch(root, partition)));
 
     for (int r = 0; r < results.size(); ++r) {
         // Enqueuing new clustering tasks in the main thread ensures determinism
@@ -134,7 +159,9 @@ void Tree::buildKMeansTree(SRMatrix<Feature>& labelsFeatures, Args& args) {
             } else {
                 TreeNodePartition childPart = {n, partitions[i]};
                 results.emplace_back(tPool.enqueue(buildKMeansTreeThread, childPart, std::ref(labelsFeatures),
-                                                   std::ref(args), kMeansSeeder(rng)));
+                                                   std::ref(args), kMeansSeeder(rng),
+                                                   partitionThreads(partitions[i]),
+                                                   partitionMiniBatch(n, partitions[i])));
             }
         }
 
@@ -620,4 +647,48 @@ int Tree::distanceBetweenNodes(TreeNode* n1, TreeNode* n2) {
     }
 
     return INT_MAX;
-}
\ No newline at end of file
+}
+
+FlatTree::FlatTree(Tree& tree) {
+    t = tree.nodes.size();
+    k = 0;
+
+    parent.reserve(t);
+    childrenStart.reserve(t + 1);
+    label.reserve(t);
+    index.reserve(t);
+    position.resize(t, -1);
+    th.resize(t, 0);
+
+    int maxLabel = -1;
+    for (auto& l : tree.leaves) maxLabel = std::max(maxLabel, l.first);
+    leaves.resize(maxLabel + 1, -1);
+
+    // BFS order, so the children of each node are placed next to each other
+    std::vector<TreeNode*> order;
+    order.reserve(t);
+    order.push_back(tree.root);
+    parent.push_back(-1);
+    for (int i = 0; i < order.size(); ++i) {
+        TreeNode* n = order[i];
+        childrenStart.push_back(order.size());
+        for (auto& c : n->children) {
+            order.push_back(c);
+            parent.push_back(i);
+        }
+
+        label.push_back(n->label);
+        index.push_back(n->index);
+        position[n->index] = i;
+        if (n->label >= 0) {
+            leaves[n->label] = i;
+            ++k;
+        }
+    }
+    childrenStart.push_back(order.size());
+    t = order.size();
+}
+
+void FlatTree::updateThresholds(Tree& tree) {
+    for (int i = 0; i < t; ++i) th[i] = tree.nodes[index[i]]->th;
+}
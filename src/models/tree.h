@@ -10,6 +10,7 @@
 #pragma once
 
 #include <algorithm>
+#include <cstdint>
 #include <fstream>
 #include <queue>
 #include <string>
@@ -40,6 +41,43 @@ struct TreeNode {
     int subtreeLeaves;
 };
 
+// Set of tree nodes for gathering nodes to update, nodes are identified by their index (index of the base classifier)
+// and marked in the array, marks are stamped with the generation number, so clearing the set does not require any work
+// or allocation
+class TreeNodeSet {
+public:
+    TreeNodeSet(): generation(1) {};
+
+    inline void clear() {
+        nodes.clear();
+        if (++generation == 0) { // Generation counter overflow, reset marks
+            std::fill(marks.begin(), marks.end(), 0);
+            generation = 1;
+        }
+    }
+
+    inline bool insert(int n) {
+        if (n >= marks.size()) marks.resize(n + 1, 0);
+        if (marks[n] == generation) return false;
+        marks[n] = generation;
+        nodes.push_back(n);
+        return true;
+    }
+
+    inline bool count(int n) const { return n < marks.size() && marks[n] == generation; }
+
+    inline size_t size() const { return nodes.size(); }
+    inline bool empty() const { return nodes.empty(); }
+
+    inline std::vector<int>::const_iterator begin() const { return nodes.begin(); }
+    inline std::vector<int>::const_iterator end() const { return nodes.end(); }
+
+private:
+    std::vector<int> nodes;
+    std::vector<uint32_t> marks;
+    uint32_t generation;
+};
+
 // For prediction in tree based models / Huffman trees building
 struct TreeNodeValue {
     TreeNodeValue(TreeNode* node, double value): node(node), value(value) {};
@@ -51,6 +89,17 @@ struct TreeNodeValue {
     bool operator>(const TreeNodeValue& r) const { return value > r.value; }
 };
 
+// For prediction in tree based models using flattened tree
+struct FlatNodeValue {
+    FlatNodeValue(int node, double value): node(node), value(value) {};
+
+    int node; // Position of the node in the flattened tree
+    double value; // Node's value/probability
+
+    bool operator<(const FlatNodeValue& r) const { return value < r.value; }
+    bool operator>(const FlatNodeValue& r) const { return value > r.value; }
+};
+
 // For K-Means based trees
 struct TreeNodePartition {
     TreeNode* node;
@@ -64,7 +113,9 @@ public:
 
     // Build tree structure of given type
     void buildTreeStructure(int labelCount, Args& args);
-    void buildTreeStructure(SRMatrix<Label>& labels, SRMatrix<Feature>& features, Args& args);
+    // Precomputed labels' features matrix can be provided for k-means tree
+    void buildTreeStructure(SRMatrix<Label>& labels, SRMatrix<Feature>& features, Args& args,
+                            SRMatrix<Feature>* labelsFeatures = nullptr);
 
     // Hierarchical K-Means
     void buildKMeansTree(SRMatrix<Feature>& labelsFeatures, Args& args);
@@ -111,6 +162,34 @@ public:
 
 private:
     static TreeNodePartition buildKMeansTreeThread(TreeNodePartition nPart, SRMatrix<Feature>& labelsFeatures,
-                                                   Args& args, int seed);
+                                                   Args& args, int seed, int threads, bool miniBatch);
+
+};
 
+// Immutable, flattened copy of the tree for fast traversal during prediction, nodes are stored in BFS order,
+// so children of each node occupy a contiguous range of positions
+class FlatTree {
+public:
+    FlatTree(): k(0), t(0) {};
+    explicit FlatTree(Tree& tree);
+
+    int k; // Number of leaves
+    int t; // Number of tree nodes
+
+    std::vector<int> parent;        // Position of the parent node, -1 for the root
+    std::vector<int> childrenStart; // Children of the node at position n are at [childrenStart[n], childrenStart[n + 1])
+    std::vector<int> label;         // Label of the node, -1 for internal nodes
+    std::vector<int> index;         // Index of the base classifier of the node
+    std::vector<int> position;      // Position of the node with given index
+    std::vector<int> leaves;        // Position of the leaf with given label, -1 if label is not in the tree
+    std::vector<double> th;         // Thresholds of the nodes
+
+    inline int root() const { return 0; }
+    inline int childrenBegin(int n) const { return childrenStart[n]; }
+    inline int childrenEnd(int n) const { return childrenStart[n + 1]; }
+    inline bool isLeaf(int n) const { return childrenStart[n] == childrenStart[n + 1]; }
+    inline int leaf(int l) const { return (l >= 0 && l < leaves.size()) ? leaves[l] : -1; }
+
+    // Copy thresholds from the tree nodes
+    void updateThresholds(Tree& tree);
 };
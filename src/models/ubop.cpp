@@ -10,6 +10,7 @@
 #include <list>
 #include <vector>
 
+#include "prediction_context.h"
 #include "set_utility.h"
 #include "ubop.h"
 
@@ -19,12 +20,14 @@ UBOP::UBOP() {
     name = "UBOP";
 }
 
-void UBOP::predict(std::vector<Prediction>& prediction, Feature* features, Args& args) {
-    std::vector<Prediction> allPredictions;
-    allPredictions = OVR::predictForAllLabels(features, args);
+void UBOP::predict(std::vector<Prediction>& prediction, Feature* features, const PredictOptions& options) const {
+    PredictionContext& context = PredictionContext::local();
+    std::vector<Prediction>& allPredictions = context.predictions;
+    allPredictions.clear();
+    OVR::predictForAllLabels(allPredictions, features, options);
     sort(allPredictions.rbegin(), allPredictions.rend());
 
-    std::shared_ptr<SetUtility> u = SetUtility::factory(args, outputSize());
+    SetUtility* u = &context.getSetUtility(options, outputSize());
 
     double P = 0, bestU = 0;
     for (const auto& p : allPredictions) {
@@ -4,6 +4,7 @@
  */
 
 #include "ubop_hsm.h"
+#include "prediction_context.h"
 #include "set_utility.h"
 
 
@@ -12,15 +13,17 @@ UBOPHSM::UBOPHSM() {
     name = "UBOP HSM";
 }
 
-void UBOPHSM::predict(std::vector<Prediction>& prediction, Feature* features, Args& args) {
-    TopKQueue<TreeNodeValue> nQueue;
+void UBOPHSM::predict(std::vector<Prediction>& prediction, Feature* features, const PredictOptions& options) const {
+    PredictionContext& context = PredictionContext::local();
+    TopKQueue<FlatNodeValue>& nQueue = context.nQueue;
+    nQueue.reset(0);
 
-    double value = bases[tree->root->index]->predictProbability(features);
+    double value = predictForNode(flatTree.root(), features);
     assert(value == 1);
-    nQueue.push({tree->root, value});
-    ++dataPointCount;
+    nQueue.push({flatTree.root(), value});
+    ++metrics.local().dataPoints;
 
-    std::shared_ptr<SetUtility> u = SetUtility::factory(args, outputSize());
+    SetUtility* u = &context.getSetUtility(options, outputSize());
 
     double P = 0, bestU = 0;
     while (!nQueue.empty()) {
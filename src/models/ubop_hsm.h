@@ -12,5 +12,11 @@ class UBOPHSM : public HSM {
 public:
     UBOPHSM();
 
-    void predict(std::vector<Prediction>& prediction, Feature* features, Args& args) override;
+    void predict(std::vector<Prediction>& prediction, Feature* features, const PredictOptions& options) const override;
+
+    // UBOP uses its own search, so examples are predicted one by one
+    std::vector<std::vector<Prediction>> predictBatch(SRMatrix<Feature>& features,
+                                                      const PredictOptions& options) const override {
+        return Model::predictBatch(features, options);
+    }
 };
\ No newline at end of file
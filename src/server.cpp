@@ -0,0 +1,417 @@
+/**
+ * Copyright (c) 2020 by Marek Wydmuch
+ * All rights reserved.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "misc.h"
+#include "server.h"
+
+// Size of the buffer for reading from the clients
+const int readBufferSize = 1 << 16;
+
+// Longer lines are rejected and the connection is closed
+const size_t maxLineSize = 1 << 24;
+
+static volatile std::sig_atomic_t stopSignal = 0;
+
+static void handleStopSignal(int signal) { stopSignal = 1; }
+
+static bool sendAll(int socket, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t s = send(socket, data.data() + sent, data.size() - sent, 0);
+        if (s < 0 && errno == EINTR) continue;
+        if (s <= 0) return false;
+        sent += s;
+    }
+    return true;
+}
+
+Server::Server(Args& args): args(args), listenSocket(-1), stopping(false), idleWorkers(0) {
+    served = loadModel();
+    servedId = modelId();
+    served->args.printArgs();
+}
+
+Server::~Server() {
+    if (listenSocket >= 0) close(listenSocket);
+    if (!unixSocketPath.empty()) unlink(unixSocketPath.c_str());
+}
+
+std::shared_ptr<Server::ServedModel> Server::loadModel() {
+    auto newServed = std::make_shared<ServedModel>();
+    newServed->args = args;
+
+    // Load model args
+    newServed->args.loadFromFile(joinPath(args.output, "args.bin"));
+
+    // Create data reader
+    newServed->reader = DataReader::factory(newServed->args);
+    newServed->reader->loadFromFile(joinPath(args.output, "data_reader.bin"));
+
+    // Load model
+    newServed->model = Model::factory(newServed->args);
+    newServed->model->load(newServed->args, args.output);
+    if (!newServed->args.thresholds.empty())
+        newServed->model->setThresholds(loadThresholds(newServed->args.thresholds));
+
+    return newServed;
+}
+
+std::shared_ptr<Server::ServedModel> Server::currentModel() {
+    std::lock_guard<std::mutex> lock(servedMutex);
+    return served;
+}
+
+std::string Server::modelId() {
+    // New model directory (renamed or pointed by switched symlink) has a different inode
+    struct stat s;
+    if (stat(args.output.c_str(), &s) != 0) return "";
+    return std::to_string(s.st_dev) + ":" + std::to_string(s.st_ino);
+}
+
+std::string Server::reload(bool force) {
+    std::lock_guard<std::mutex> lock(reloadMutex);
+    std::string id = modelId();
+    if (id.empty()) return "Model path does not exist";
+    if (!force && id == servedId) return "";
+
+    std::cerr << "Reloading model from: " << args.output << " ...\n";
+    servedId = id; // Not retried automatically if loading fails
+    try {
+        std::shared_ptr<ServedModel> newServed = loadModel();
+
+        // Requests in progress keep the previous model until they are predicted
+        std::lock_guard<std::mutex> servedLock(servedMutex);
+        served = newServed;
+    } catch (const std::exception& e) {
+        std::cerr << "  Failed to reload model: " << e.what() << "\n";
+        return e.what();
+    }
+
+    return "";
+}
+
+void Server::listen() {
+    // Address is a TCP port (optionally prefixed with localhost) or a path of Unix domain socket
+    std::string address = args.input;
+    for (const char* prefix : {"localhost:", "127.0.0.1:"})
+        if (address.compare(0, std::strlen(prefix), prefix) == 0) address = address.substr(std::strlen(prefix));
+    bool tcp = !address.empty() && std::all_of(address.begin(), address.end(), ::isdigit);
+
+    if (tcp) {
+        listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+        if (listenSocket < 0) throw std::runtime_error("Failed to create socket: " + std::string(strerror(errno)));
+        int reuse = 1;
+        setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(std::stoi(address));
+        if (bind(listenSocket, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0)
+            throw std::runtime_error("Failed to bind to port " + address + ": " + strerror(errno));
+        std::cerr << "Listening on localhost:" << address << " ...\n";
+    } else {
+        sockaddr_un addr{};
+        if (args.input.size() >= sizeof(addr.sun_path))
+            throw std::invalid_argument("Too long Unix domain socket path: " + args.input);
+        listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listenSocket < 0) throw std::runtime_error("Failed to create socket: " + std::string(strerror(errno)));
+
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, args.input.c_str(), sizeof(addr.sun_path) - 1);
+        unlink(args.input.c_str()); // Remove socket left by previous server
+        if (bind(listenSocket, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0)
+            throw std::runtime_error("Failed to bind to " + args.input + ": " + strerror(errno));
+        unixSocketPath = args.input;
+        std::cerr << "Listening on " << args.input << " ...\n";
+    }
+
+    if (::listen(listenSocket, SOMAXCONN) != 0)
+        throw std::runtime_error("Failed to listen: " + std::string(strerror(errno)));
+}
+
+void Server::run() {
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, handleStopSignal);
+    signal(SIGTERM, handleStopSignal);
+
+    listen();
+
+    std::cerr << "Starting " << args.threads << " prediction workers ...\n";
+    for (int t = 0; t < args.threads; ++t) workers.emplace_back(&Server::workerThread, this);
+    if (args.reloadInterval > 0) reloader = std::thread(&Server::reloaderThread, this);
+
+    while (!stopSignal) {
+        pollfd p{listenSocket, POLLIN, 0};
+        int ready = poll(&p, 1, 200);
+
+        // Clean up after disconnected clients
+        for (auto c = connections.begin(); c != connections.end();) {
+            bool finished;
+            {
+                std::lock_guard<std::mutex> lock((*c)->mutex);
+                finished = (*c)->finished;
+            }
+            if (finished) {
+                (*c)->thread.join();
+                close((*c)->socket);
+                c = connections.erase(c);
+            } else
+                ++c;
+        }
+
+        if (ready <= 0) continue;
+        int clientSocket = accept(listenSocket, nullptr, nullptr);
+        if (clientSocket < 0) continue;
+
+        connections.emplace_back(new Connection());
+        Connection* connection = connections.back().get();
+        connection->socket = clientSocket;
+        connection->pending = 0;
+        connection->finished = false;
+        connection->thread = std::thread(&Server::connectionThread, this, connection);
+    }
+
+    std::cerr << "Stopping server ...\n";
+
+    // Connections finish their requests before the workers stop
+    for (auto& c : connections) shutdown(c->socket, SHUT_RDWR);
+    for (auto& c : connections) {
+        c->thread.join();
+        close(c->socket);
+    }
+    connections.clear();
+
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        stopping = true;
+    }
+    notEmpty.notify_all();
+    stopped.notify_all();
+    for (auto& w : workers) w.join();
+    if (reloader.joinable()) reloader.join();
+}
+
+void Server::connectionThread(Connection* connection) {
+    int topK = args.topK;
+    double threshold = args.threshold;
+
+    std::vector<char> buffer(readBufferSize);
+    std::string unfinished;
+    std::vector<std::unique_ptr<Request>> requests;
+    std::string replies;
+
+    while (true) {
+        ssize_t size = recv(connection->socket, buffer.data(), buffer.size(), 0);
+        if (size < 0 && errno == EINTR) continue;
+        if (size <= 0) break;
+        unfinished.append(buffer.data(), size);
+
+        // All complete lines received together are enqueued before waiting for any of them
+        size_t start = 0, end;
+        while ((end = unfinished.find('\n', start)) != std::string::npos) {
+            std::string line = unfinished.substr(start, end - start);
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            requests.emplace_back(new Request());
+            processLine(line, connection, requests.back().get(), topK, threshold);
+            start = end + 1;
+        }
+        unfinished.erase(0, start);
+        if (unfinished.size() > maxLineSize) {
+            sendAll(connection->socket, "!error Too long line\n");
+            break;
+        }
+        if (requests.empty()) continue;
+
+        {
+            std::unique_lock<std::mutex> lock(connection->mutex);
+            connection->done.wait(lock, [&] { return connection->pending == 0; });
+        }
+
+        replies.clear();
+        for (const auto& r : requests) replies += r->response;
+        requests.clear();
+        if (!sendAll(connection->socket, replies)) break;
+    }
+
+    // Wait for requests still in the queue before the connection is cleaned up
+    std::unique_lock<std::mutex> lock(connection->mutex);
+    connection->done.wait(lock, [&] { return connection->pending == 0; });
+    connection->finished = true;
+}
+
+void Server::processLine(std::string& line, Connection* connection, Request* request, int& topK, double& threshold) {
+    // Commands change the settings of the connection
+    if (!line.empty() && line[0] == '!') {
+        auto tokens = split(line.substr(1), ' ');
+        try {
+            if (tokens.size() == 2 && tokens[0] == "topK")
+                topK = std::stoi(tokens[1]);
+            else if (tokens.size() == 2 && tokens[0] == "threshold")
+                threshold = std::stod(tokens[1]);
+            else if (tokens.size() == 1 && tokens[0] == "reload") {
+                std::string error = reload(true);
+                if (!error.empty()) throw std::runtime_error(error);
+            } else
+                throw std::invalid_argument("Unknown command");
+            request->response = "!ok\n";
+        } catch (const std::exception& e) {
+            request->response = "!error " + std::string(e.what()) + "\n";
+        }
+        return;
+    }
+
+    request->served = currentModel();
+    request->topK = topK;
+    request->threshold = threshold;
+    request->connection = connection;
+
+    std::vector<Label> labels;
+    try {
+        request->served->reader->readKnownPoint(line, labels, request->features, request->served->args);
+    } catch (const std::exception& e) {
+        request->response = "!error Failed to read data point\n";
+        return;
+    }
+    request->features.push_back({-1, 0}); // Termination feature, as in SRMatrix rows
+
+    enqueue(request);
+}
+
+void Server::enqueue(Request* request) {
+    {
+        std::lock_guard<std::mutex> lock(request->connection->mutex);
+        ++request->connection->pending;
+    }
+
+    std::unique_lock<std::mutex> lock(queueMutex);
+    // Backpressure, the client is not read until the queue has room for its requests
+    notFull.wait(lock, [&] { return queue.size() < static_cast<size_t>(args.maxQueueSize); });
+    request->arrival = std::chrono::steady_clock::now();
+    queue.push_back(request);
+    if (queue.size() >= static_cast<size_t>(args.maxBatchSize))
+        notEmpty.notify_all();
+    else
+        notEmpty.notify_one();
+}
+
+bool Server::nextBatch(std::vector<Request*>& batch) {
+    batch.clear();
+    std::unique_lock<std::mutex> lock(queueMutex);
+    ++idleWorkers;
+    if (!queue.empty()) notEmpty.notify_all(); // Worker waiting for a fuller batch can take the requests now
+    while (true) {
+        notEmpty.wait(lock, [&] { return stopping || !queue.empty(); });
+        if (queue.empty()) {
+            --idleWorkers;
+            return false;
+        }
+
+        // Waiting for a fuller batch pays off only when all the other workers are busy,
+        // but not longer than the batch timeout since the oldest request arrived
+        if (idleWorkers > 1) break;
+        auto deadline = queue.front()->arrival + std::chrono::microseconds(args.batchTimeout);
+        notEmpty.wait_until(lock, deadline, [&] {
+            return stopping || idleWorkers > 1 || queue.size() >= static_cast<size_t>(args.maxBatchSize);
+        });
+        if (!queue.empty()) break; // Other worker could take the requests in the meantime
+    }
+
+    // Requests are shared between the idle workers
+    int size = std::min<int>((queue.size() + idleWorkers - 1) / idleWorkers, args.maxBatchSize);
+    --idleWorkers;
+    batch.insert(batch.end(), queue.begin(), queue.begin() + size);
+    queue.erase(queue.begin(), queue.begin() + size);
+    if (!queue.empty()) notEmpty.notify_one();
+    lock.unlock();
+    notFull.notify_all();
+
+    return true;
+}
+
+void Server::predictRequests(Request* const* requests, int size) {
+    const ServedModel& served = *requests[0]->served;
+    PredictOptions options(served.args);
+    options.threads = 1; // Requests are predicted in parallel, so the model should not start threads
+    options.topK = requests[0]->topK;
+    options.threshold = requests[0]->threshold;
+
+    // Buffers are reused by the following batches of the worker
+    static thread_local std::vector<std::vector<Prediction>> predictions;
+    static thread_local std::vector<Feature*> rows;
+    if (predictions.size() < static_cast<size_t>(size)) predictions.resize(size);
+    rows.clear();
+    for (int i = 0; i < size; ++i) {
+        predictions[i].clear();
+        rows.push_back(requests[i]->features.data());
+    }
+
+    try {
+        if (!served.args.thresholds.empty()) {
+            for (int i = 0; i < size; ++i) served.model->predictWithThresholds(predictions[i], rows[i], options);
+        } else
+            served.model->predictRows(predictions.data(), rows.data(), size, options);
+    } catch (const std::exception& e) {
+        for (int i = 0; i < size; ++i) requests[i]->response = "!error " + std::string(e.what()) + "\n";
+        return;
+    }
+
+    for (int i = 0; i < size; ++i) {
+        std::ostringstream response;
+        response << std::setprecision(5);
+        for (const auto& p : predictions[i]) response << p.label << ":" << p.value << " ";
+        response << "\n";
+        requests[i]->response = response.str();
+    }
+}
+
+void Server::workerThread() {
+    std::vector<Request*> batch;
+
+    while (nextBatch(batch)) {
+        // Consecutive requests for the same model and settings are predicted as one block
+        for (size_t start = 0; start < batch.size();) {
+            Request* first = batch[start];
+            size_t stop = start + 1;
+            while (stop < batch.size() && batch[stop]->served == first->served && batch[stop]->topK == first->topK
+                   && batch[stop]->threshold == first->threshold)
+                ++stop;
+            predictRequests(batch.data() + start, stop - start);
+            start = stop;
+        }
+        for (auto r : batch) r->served.reset(); // Previous model can be released after reload
+
+        for (auto r : batch) {
+            Connection* connection = r->connection;
+            std::lock_guard<std::mutex> lock(connection->mutex);
+            if (--connection->pending == 0) connection->done.notify_one();
+        }
+    }
+}
+
+void Server::reloaderThread() {
+    std::unique_lock<std::mutex> lock(queueMutex);
+    while (!stopped.wait_for(lock, std::chrono::seconds(args.reloadInterval), [&] { return stopping; })) {
+        lock.unlock();
+        reload(false);
+        lock.lock();
+    }
+}
@@ -0,0 +1,102 @@
+/**
+ * Copyright (c) 2020 by Marek Wydmuch
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "args.h"
+#include "data_reader.h"
+#include "model.h"
+#include "types.h"
+
+// Prediction server, loads the model once and predicts data points sent by the clients over
+// an Unix domain socket or a localhost TCP port. Requests of all the clients are put into one bounded queue
+// and predicted in micro-batches by the pool of workers.
+class Server {
+public:
+    explicit Server(Args& args);
+    ~Server();
+
+    // Accepts clients until SIGINT or SIGTERM is received
+    void run();
+
+private:
+    // Model together with the args and the data reader it was loaded with
+    struct ServedModel {
+        Args args;
+        std::shared_ptr<DataReader> reader;
+        std::shared_ptr<Model> model;
+    };
+
+    struct Connection;
+
+    struct Request {
+        std::shared_ptr<ServedModel> served; // Model that read the features, the same model is used for prediction
+        std::vector<Feature> features;
+        int topK;
+        double threshold;
+        std::chrono::steady_clock::time_point arrival;
+        std::string response;
+        Connection* connection;
+    };
+
+    struct Connection {
+        int socket;
+        int pending; // Number of the connection's requests not yet predicted
+        bool finished;
+        std::mutex mutex;
+        std::condition_variable done;
+        std::thread thread;
+    };
+
+    Args args;
+    int listenSocket;
+    std::string unixSocketPath;
+
+    std::shared_ptr<ServedModel> served;
+    std::string servedId; // Identifies model directory the served model was loaded from
+    std::mutex servedMutex;
+    std::mutex reloadMutex;
+
+    // Queue of requests waiting for prediction
+    std::deque<Request*> queue;
+    std::mutex queueMutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+    std::condition_variable stopped;
+    bool stopping;
+    int idleWorkers; // Number of workers waiting for the next batch
+
+    std::vector<std::thread> workers;
+    std::thread reloader;
+    std::list<std::unique_ptr<Connection>> connections;
+
+    std::shared_ptr<ServedModel> loadModel();
+    std::shared_ptr<ServedModel> currentModel();
+    std::string modelId();
+    // Loads the model if the model directory changed or if forced, returns error message if loading failed
+    std::string reload(bool force);
+
+    void listen();
+    void connectionThread(Connection* connection);
+    // Replies to the command or reads the data point and enqueues it for prediction
+    void processLine(std::string& line, Connection* connection, Request* request, int& topK, double& threshold);
+    void enqueue(Request* request);
+    // Takes the next micro-batch from the queue, returns false if server is stopping
+    bool nextBatch(std::vector<Request*>& batch);
+    // Predicts requests for the same model and settings together
+    static void predictRequests(Request* const* requests, int size);
+    void workerThread();
+    void reloaderThread();
+};
@@ -8,21 +8,22 @@
 #include "set_utility.h"
 
 
-std::shared_ptr<SetUtility> SetUtility::factory(Args& args, int outputSize) {
+std::shared_ptr<SetUtility> SetUtility::factory(const PredictOptions& options, int outputSize) {
     std::shared_ptr<SetUtility> u = nullptr;
-    switch (args.setUtilityType) {
+    switch (options.setUtilityType) {
     case uP: u = std::static_pointer_cast<SetUtility>(std::make_shared<PrecisionUtility>()); break;
     case uR: u = std::static_pointer_cast<SetUtility>(std::make_shared<RecallUtility>()); break;
     case uF1: u = std::static_pointer_cast<SetUtility>(std::make_shared<FBetaUtility>(1)); break;
-    case uFBeta: u = std::static_pointer_cast<SetUtility>(std::make_shared<FBetaUtility>(args.beta)); break;
-    case uExp: u = std::static_pointer_cast<SetUtility>(std::make_shared<FBetaUtility>(args.beta)); break;
-    case uLog: u = std::static_pointer_cast<SetUtility>(std::make_shared<FBetaUtility>(args.beta)); break;
-    case uAlpha: u = std::static_pointer_cast<SetUtility>(std::make_shared<UtilityAlphaBeta>(args.alpha, 0, outputSize)); break;
+    case uFBeta: u = std::static_pointer_cast<SetUtility>(std::make_shared<FBetaUtility>(options.beta)); break;
+    case uExp: u = std::static_pointer_cast<SetUtility>(std::make_shared<FBetaUtility>(options.beta)); break;
+    case uLog: u = std::static_pointer_cast<SetUtility>(std::make_shared<FBetaUtility>(options.beta)); break;
+    case uAlpha: u = std::static_pointer_cast<SetUtility>(std::make_shared<UtilityAlphaBeta>(options.alpha, 0, outputSize)); break;
     case uAlphaBeta:
-        u = std::static_pointer_cast<SetUtility>(std::make_shared<UtilityAlphaBeta>(args.alpha, args.beta, outputSize));
+        u = std::static_pointer_cast<SetUtility>(
+            std::make_shared<UtilityAlphaBeta>(options.alpha, options.beta, outputSize));
         break;
     case uDeltaGamma:
-        u = std::static_pointer_cast<SetUtility>(std::make_shared<UtilityDeltaGamma>(args.delta, args.gamma));
+        u = std::static_pointer_cast<SetUtility>(std::make_shared<UtilityDeltaGamma>(options.delta, options.gamma));
         break;
     default: throw std::invalid_argument("Unknown set based utility type!");
     }
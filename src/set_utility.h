@@ -11,7 +11,7 @@
 
 class SetUtility : public Measure {
 public:
-    static std::shared_ptr<SetUtility> factory(Args& args, int outputSize);
+    static std::shared_ptr<SetUtility> factory(const PredictOptions& options, int outputSize);
 
     SetUtility();
 
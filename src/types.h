@@ -5,11 +5,13 @@
 
 #pragma once
 
+#include <algorithm>
 #include <cassert>
 #include <cstddef>
 #include <cstdlib>
 #include <cstring>
 #include <fstream>
+#include <functional>
 #include <vector>
 #include <queue>
 
@@ -61,38 +63,61 @@ public:
     explicit TopKQueue(int k): k(k){};
     ~TopKQueue() = default;
 
+    // Empties the queue, but keeps its memory, so the queue can be reused
+    inline void reset(int newK){
+        k = newK;
+        mainQueue.clear();
+        finalQueue.clear();
+    }
+
     inline bool empty(){
         return mainQueue.empty();
     }
 
+    inline size_t size(){
+        return mainQueue.size();
+    }
+
     inline void push(T x, bool final = false){
         if(k > 0){
             if(final){
                 if(finalQueue.size() < k){
-                    finalQueue.push(x);
-                    mainQueue.push(x);
-                } else if(finalQueue.top() < x){
-                    finalQueue.pop();
-                    finalQueue.push(x);
-                    mainQueue.push(x);
+                    pushFinal(x);
+                    pushMain(x);
+                } else if(finalQueue.front() < x){
+                    std::pop_heap(finalQueue.begin(), finalQueue.end(), std::greater<>());
+                    finalQueue.pop_back();
+                    pushFinal(x);
+                    pushMain(x);
                 }
             }
-            else if(finalQueue.size() < k || finalQueue.top() < x) mainQueue.push(x);
-        } else mainQueue.push(x);
+            else if(finalQueue.size() < k || finalQueue.front() < x) pushMain(x);
+        } else pushMain(x);
     }
 
     inline void pop(){
-        mainQueue.pop();
+        std::pop_heap(mainQueue.begin(), mainQueue.end());
+        mainQueue.pop_back();
     }
 
     inline T top(){
-        return mainQueue.top();
+        return mainQueue.front();
     }
 
 private:
-    std::priority_queue<T> mainQueue;
-    std::priority_queue<T, std::vector<T>, std::greater<>> finalQueue;
+    std::vector<T> mainQueue; // Max-heap of all elements
+    std::vector<T> finalQueue; // Min-heap of top k final elements
     int k;
+
+    inline void pushMain(T& x){
+        mainQueue.push_back(x);
+        std::push_heap(mainQueue.begin(), mainQueue.end());
+    }
+
+    inline void pushFinal(T& x){
+        finalQueue.push_back(x);
+        std::push_heap(finalQueue.begin(), finalQueue.end(), std::greater<>());
+    }
 };
 
 // Simple dense vector
@@ -115,6 +140,7 @@ public:
 
     // Returns data as T*
     inline T* data() { return d; }
+    inline const T* data() const { return d; }
 
     // Access row also by [] operator
     inline T& operator[](const int index) { return d[index]; }
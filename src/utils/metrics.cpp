@@ -0,0 +1,121 @@
+/**
+ * Copyright (c) 2020 by Marek Wydmuch
+ * All rights reserved.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <string>
+
+#include "metrics.h"
+
+void Histogram::merge(const Histogram& other) {
+    for (int b = 0; b < buckets; ++b) counts[b] += other.counts[b];
+    count += other.count;
+    sum += other.sum;
+    if (max < other.max) max = other.max;
+}
+
+uint64_t Histogram::percentile(double p) const {
+    if (!count) return 0;
+    uint64_t rank = std::ceil(p * count);
+    uint64_t seen = 0;
+    for (int b = 0; b < buckets; ++b) {
+        seen += counts[b];
+        if (seen >= rank) return std::min(max, b ? (uint64_t(1) << b) - 1 : 0);
+    }
+    return max;
+}
+
+void Histogram::print(std::ostream& out, const std::string& name, const std::string& unit) const {
+    if (!count) return;
+    out << "  " << name << " (" << unit << "): mean: " << mean() << ", p50: " << percentile(0.5)
+        << ", p90: " << percentile(0.9) << ", p99: " << percentile(0.99) << ", max: " << max << "\n";
+}
+
+void Histogram::saveJson(std::ostream& out) const {
+    out << "{\"count\": " << count << ", \"mean\": " << mean() << ", \"p50\": " << percentile(0.5)
+        << ", \"p90\": " << percentile(0.9) << ", \"p99\": " << percentile(0.99) << ", \"max\": " << max
+        << ", \"buckets\": [";
+    int last = buckets - 1;
+    while (last > 0 && !counts[last]) --last;
+    for (int b = 0; b <= last; ++b) out << (b ? ", " : "") << counts[b];
+    out << "]}";
+}
+
+void MetricsCounters::merge(const MetricsCounters& other) {
+    dataPoints += other.dataPoints;
+    nodeEvaluations += other.nodeEvaluations;
+    nodeUpdates += other.nodeUpdates;
+    pathLength += other.pathLength;
+    latency.merge(other.latency);
+    nodesPerDataPoint.merge(other.nodesPerDataPoint);
+    queueSize.merge(other.queueSize);
+}
+
+// Slots of destroyed metrics, reused by the new ones, so the threads' counters stay as large as the number of metrics
+static std::mutex slotsMutex;
+static std::vector<size_t> freeSlots;
+static size_t nextSlot = 0;
+
+Metrics::Metrics() {
+    static std::atomic<uint64_t> nextId(1);
+    id = nextId++;
+
+    std::lock_guard<std::mutex> lock(slotsMutex);
+    if (!freeSlots.empty()) {
+        slot = freeSlots.back();
+        freeSlots.pop_back();
+    } else
+        slot = nextSlot++;
+}
+
+Metrics::~Metrics() {
+    std::lock_guard<std::mutex> lock(slotsMutex);
+    freeSlots.push_back(slot);
+}
+
+MetricsCounters& Metrics::addThread() {
+    std::vector<ThreadCounters>& threadCounters = localCounters();
+    if (threadCounters.size() <= slot) threadCounters.resize(slot + 1);
+
+    std::lock_guard<std::mutex> lock(countersMutex);
+    counters.emplace_back(new MetricsCounters());
+    threadCounters[slot] = {id, counters.back().get()};
+    return *counters.back();
+}
+
+MetricsCounters Metrics::merged() {
+    std::lock_guard<std::mutex> lock(countersMutex);
+    MetricsCounters result;
+    for (const auto& c : counters) result.merge(*c);
+    return result;
+}
+
+void Metrics::reset() {
+    std::lock_guard<std::mutex> lock(countersMutex);
+    for (auto& c : counters) *c = MetricsCounters();
+}
+
+void Metrics::print(std::ostream& out) {
+    MetricsCounters m = merged();
+    if (!m.latency.size() && !m.nodesPerDataPoint.size()) return;
+
+    out << "Prediction metrics:\n";
+    m.latency.print(out, "Latency / data point", "ns");
+    m.nodesPerDataPoint.print(out, "Evaluated estimators / data point", "count");
+    m.queueSize.print(out, "Queue size / data point", "count");
+}
+
+void Metrics::saveJson(std::ostream& out) {
+    MetricsCounters m = merged();
+    out << std::setprecision(8) << "{\"dataPoints\": " << m.dataPoints << ", \"nodeEvaluations\": " << m.nodeEvaluations
+        << ", \"nodeUpdates\": " << m.nodeUpdates << ", \"pathLength\": " << m.pathLength << ",\n \"latencyNs\": ";
+    m.latency.saveJson(out);
+    out << ",\n \"nodesPerDataPoint\": ";
+    m.nodesPerDataPoint.saveJson(out);
+    out << ",\n \"queueSize\": ";
+    m.queueSize.saveJson(out);
+    out << "}\n";
+}
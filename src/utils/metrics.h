@@ -0,0 +1,104 @@
+/**
+ * Copyright (c) 2020 by Marek Wydmuch
+ * All rights reserved.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Histogram with power of two buckets, bucket b counts values from [2^(b-1), 2^b)
+class Histogram {
+public:
+    static const int buckets = 64;
+
+    inline void add(uint64_t value) {
+        int b = value ? std::min(buckets - 1, 64 - __builtin_clzll(value)) : 0;
+        ++counts[b];
+        ++count;
+        sum += value;
+        if (max < value) max = value;
+    }
+
+    void merge(const Histogram& other);
+    inline uint64_t size() const { return count; }
+    inline double mean() const { return count ? static_cast<double>(sum) / count : 0; }
+    // Upper bound of the bucket with the given percentile
+    uint64_t percentile(double p) const;
+
+    void print(std::ostream& out, const std::string& name, const std::string& unit) const;
+    void saveJson(std::ostream& out) const;
+
+private:
+    std::array<uint64_t, buckets> counts{};
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t max = 0;
+};
+
+// Counters of a single thread
+struct MetricsCounters {
+    uint64_t dataPoints = 0;
+    uint64_t nodeEvaluations = 0; // Evaluated estimators
+    uint64_t nodeUpdates = 0; // Updated estimators
+    uint64_t pathLength = 0; // Length of the labels' paths (HSM)
+
+    Histogram latency; // Prediction time of the data point in nanoseconds
+    Histogram nodesPerDataPoint; // Evaluated estimators per data point
+    Histogram queueSize; // Largest size of the nodes' queue per data point
+
+    char padding[64]; // Keeps counters of the threads on separate cache lines
+
+    void merge(const MetricsCounters& other);
+};
+
+// Metrics of the model, every thread updates its own counters and they are merged only when read
+class Metrics {
+public:
+    Metrics();
+    ~Metrics();
+    Metrics(const Metrics&) = delete;
+    Metrics& operator=(const Metrics&) = delete;
+
+    // Counters of the calling thread
+    inline MetricsCounters& local() {
+        std::vector<ThreadCounters>& threadCounters = localCounters();
+        if (slot < threadCounters.size() && threadCounters[slot].id == id) return *threadCounters[slot].counters;
+        return addThread();
+    }
+
+    // Sum of counters of all the threads, should not be called during the update
+    MetricsCounters merged();
+    void reset();
+
+    void print(std::ostream& out);
+    void saveJson(std::ostream& out);
+
+private:
+    // Counters of the thread for the metrics in the slot, valid only if the id matches, since slots are reused
+    struct ThreadCounters {
+        uint64_t id = 0;
+        MetricsCounters* counters = nullptr;
+    };
+
+    uint64_t id; // Unique id of metrics
+    size_t slot; // Index of metrics in the threads' counters, reused after the metrics are destroyed
+    std::mutex countersMutex;
+    std::vector<std::unique_ptr<MetricsCounters>> counters;
+
+    // Counters of the calling thread for all the existing metrics, indexed by slot
+    static inline std::vector<ThreadCounters>& localCounters() {
+        static thread_local std::vector<ThreadCounters> threadCounters;
+        return threadCounters;
+    }
+
+    MetricsCounters& addThread();
+};
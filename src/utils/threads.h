@@ -27,6 +27,9 @@ public:
     template<class F, class... Args>
     auto enqueue(F&& f, Args&&... args) -> std::future<typename std::result_of<F(Args...)>::type>;
     void stopAll();
+    // Adds workers up to the given number, the pool is not synchronized with the callers of size and grow
+    void grow(size_t threads);
+    inline size_t size() const { return workers.size(); }
 
 private:
     // Keeps track of threads
@@ -43,7 +46,11 @@ private:
 
 // The constructor just launches some number of workers
 inline ThreadPool::ThreadPool(size_t threads): stop(false){
-    for(size_t i = 0; i < threads; ++i)
+    grow(threads);
+}
+
+inline void ThreadPool::grow(size_t threads){
+    while(workers.size() < threads)
         workers.emplace_back([this]{
                 for(;;){
                     std::function<void()> task;
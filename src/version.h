@@ -0,0 +1,13 @@
+/**
+ * Copyright (c) 2018 by Marek Wydmuch
+ * All rights reserved.
+ */
+
+#pragma once
+
+#define VERSION "0.4.0"
+#define MIPS_EXT OFF
+
+#if MIPS_EXT == OFF
+#undef MIPS_EXT
+#endif